@@ -0,0 +1,91 @@
+#include "alignment_filter.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+//------------------------------------------------------------------------------
+// integer value of a condition in [0, max_value]; base 0 also takes 0x...
+bool parse_filter_value(const std::string &value, const int base,
+        const long max_value, long *number) {
+    if (value.empty())
+        return false;
+    char *end = NULL;
+    errno = 0;
+    *number = std::strtol(value.c_str(), &end, base);
+    return ('\0' == *end && 0 == errno && 0 <= *number
+            && max_value >= *number);
+}
+//------------------------------------------------------------------------------
+bool AlignmentFilter::parse(const std::string &spec) {
+    const size_t sep = spec.find(':');
+    if (std::string::npos == sep || 0 == sep) {
+        std::cerr << ERROR_STRING << "invalid filter '" << spec
+                  << "'. It must be given as 'name:cond,cond...'." << ENDL;
+        return false;
+    }
+    this->name = spec.substr(0, sep);
+
+    hi::StringArray conds;
+    hi::split(conds, spec.substr(sep + 1), ',', hi::HISTD_SPLITMODE_NOEMPTY);
+    for (hi::StringArray::const_iterator cond = conds.begin();
+            cond != conds.end(); ++cond) {
+        const size_t eq = cond->find('=');
+        const std::string key = cond->substr(0, eq);
+        const std::string value
+                = (std::string::npos == eq) ? "" : cond->substr(eq + 1);
+
+        long number = 0;
+        if ("mapq" == key || "f" == key || "F" == key) {
+            if (!parse_filter_value(value, ("mapq" == key) ? 10 : 0,
+                        ("mapq" == key) ? EX_ALNFLT_MAX_MAPQ
+                                        : EX_ALNFLT_MAX_FLAG,
+                        &number)) {
+                std::cerr << ERROR_STRING << "invalid value of '" << *cond
+                          << "' in '" << spec << "'." << ENDL;
+                return false;
+            }
+        }
+
+        if ("mapq" == key) {
+            minMapQuality = number;
+        } else if ("strand" == key && "+" == value) {
+            excludedFlags |= EX_ALNFLT_FLAG_REVERSE;
+        } else if ("strand" == key && "-" == value) {
+            requiredFlags |= EX_ALNFLT_FLAG_REVERSE;
+        } else if ("nodup" == key) {
+            excludedFlags |= EX_ALNFLT_FLAG_DUPLICATE;
+        } else if ("nosec" == key) {
+            excludedFlags |= EX_ALNFLT_FLAG_SECONDARY;
+        } else if ("nosupp" == key) {
+            excludedFlags |= EX_ALNFLT_FLAG_SUPPLEMENTARY;
+        } else if ("noqcfail" == key) {
+            excludedFlags |= EX_ALNFLT_FLAG_QC_FAILED;
+        } else if ("proper" == key) {
+            requiredFlags |= EX_ALNFLT_FLAG_PROPER_PAIR;
+        } else if ("f" == key) {
+            requiredFlags |= number;
+        } else if ("F" == key) {
+            excludedFlags |= number;
+        } else {
+            std::cerr << ERROR_STRING << "unknown filter condition '" << *cond
+                      << "' in '" << spec << "'." << ENDL;
+            return false;
+        }
+    }
+
+    if (0 != (requiredFlags & excludedFlags)) {
+        std::cerr << WARNING_STRING << "filter '" << this->name
+                  << "' requires and excludes the same flag bits. "
+                     "No alignment will pass."
+                  << ENDL;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+AlignmentFilter::AlignmentFilter() {
+    name = "";
+    minMapQuality = 0;
+    requiredFlags = 0;
+    excludedFlags = 0;
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+#ifndef ALIGNMENT_FILTER_H
+#define ALIGNMENT_FILTER_H
+
+#include "histd.h"
+
+#include <api/BamAlignment.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// SAM flag bits
+#define EX_ALNFLT_FLAG_PROPER_PAIR 0x2
+#define EX_ALNFLT_FLAG_REVERSE 0x10
+#define EX_ALNFLT_FLAG_SECONDARY 0x100
+#define EX_ALNFLT_FLAG_QC_FAILED 0x200
+#define EX_ALNFLT_FLAG_DUPLICATE 0x400
+#define EX_ALNFLT_FLAG_SUPPLEMENTARY 0x800
+// largest values of mapq=N and f=/F=INT
+#define EX_ALNFLT_MAX_MAPQ 255
+#define EX_ALNFLT_MAX_FLAG 0xFFFF
+
+//------------------------------------------------------------------------------
+// Alignment filter that only looks at the core fields filled by
+// BamReader::GetNextAlignmentCore(). A filter is given as 'name:cond,cond...'
+// where cond is one of
+//   mapq=N    mapping quality >= N
+//   strand=+  forward strand only ('-' for reverse)
+//   nodup     exclude PCR/optical duplicates
+//   nosec     exclude secondary alignments
+//   nosupp    exclude supplementary alignments
+//   noqcfail  exclude alignments failing the vendor QC
+//   proper    properly paired alignments only
+//   f=INT     require all of the flag bits
+//   F=INT     exclude any of the flag bits
+class AlignmentFilter {
+public:
+    bool parse(const std::string &spec);
+    bool is_passed(const BamTools::BamAlignment &alignment) const {
+        return (minMapQuality <= alignment.MapQuality
+                && requiredFlags == (alignment.AlignmentFlag & requiredFlags)
+                && 0 == (alignment.AlignmentFlag & excludedFlags));
+    }
+    AlignmentFilter();
+
+    std::string name;
+    int minMapQuality;
+    uint32_t requiredFlags, excludedFlags;
+};
+typedef std::vector<AlignmentFilter> AlignmentFilterArray;
+//------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,23 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+static long numNewCalls = 0;
+//------------------------------------------------------------------------------
+void *operator new(size_t size) {
+    __sync_fetch_and_add(&numNewCalls, 1);
+    void *ptr = std::malloc(0 < size ? size : 1);
+    if (NULL == ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+//------------------------------------------------------------------------------
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+//------------------------------------------------------------------------------
+long get_num_new_calls(void) {
+    return __sync_fetch_and_add(&numNewCalls, 0);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,12 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+//------------------------------------------------------------------------------
+// Linking alloc_counter.cpp replaces the global operator new and delete of the
+// program with ones counting the calls, for the checks that the query kernels
+// make no operator new call of their own. new[] goes through operator new and
+// is counted too. malloc() is not, so the allocations HDF5 makes inside its
+// reads are outside what these checks cover.
+long get_num_new_calls(void);
+
+#endif
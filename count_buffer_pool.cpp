@@ -0,0 +1,147 @@
+#include "count_buffer_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+//------------------------------------------------------------------------------
+int get_current_numa_node(void) {
+#ifdef SYS_getcpu
+    unsigned cpu, node;
+    if (0 == syscall(SYS_getcpu, &cpu, &node, NULL))
+        return node;
+#endif
+    return 0;
+}
+//------------------------------------------------------------------------------
+int32_t *CountBufferPool::allocate(const size_t count, size_t *capacity) {
+    const size_t alignment
+            = isHugePages ? EX_CBPOOL_HUGE_PAGE_SIZE : EX_CBPOOL_ALIGNMENT;
+    size_t bytes = count * sizeof(int32_t);
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    if (0 == bytes)
+        bytes = alignment;
+
+    void *ptr = NULL;
+    if (0 != posix_memalign(&ptr, alignment, bytes))
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (isHugePages)
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+    *capacity = bytes / sizeof(int32_t);
+    return (int32_t *)ptr;
+}
+//------------------------------------------------------------------------------
+// Returns a buffer whose first 'count' elements are zero. Must be called from
+// the thread that is going to fill the buffer.
+int32_t *CountBufferPool::acquire(const size_t count) {
+    const int node = get_current_numa_node();
+    int32_t *ptr = NULL;
+
+    pthread_mutex_lock(&mutex);
+    ++nAcquired;
+    // the smallest free buffer that fits, preferring the local node
+    int hit = -1;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        const Buffer &b = buffers[i];
+        if (b.isInUse || b.capacity < count)
+            continue;
+        if (0 > hit || (b.node == node && buffers[hit].node != node)
+                || (b.node == buffers[hit].node
+                        && b.capacity < buffers[hit].capacity))
+            hit = i;
+    }
+    if (0 <= hit) {
+        buffers[hit].isInUse = true;
+        ptr = buffers[hit].ptr;
+        ++nReused;
+        if (buffers[hit].node != node)
+            ++nRemoteReused;
+    } else {
+        // a free buffer too small for this request is replaced
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            if (!buffers[i].isInUse) {
+                bytesInPool -= buffers[i].capacity * sizeof(int32_t);
+                std::free(buffers[i].ptr);
+                buffers.erase(buffers.begin() + i);
+                ++nFreed;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (NULL == ptr) {
+        Buffer b;
+        b.ptr = allocate(count, &b.capacity);
+        if (NULL == b.ptr) {
+            std::cerr << ERROR_STRING << "failed to allocate a count buffer ("
+                      << count << " elements)." << ENDL;
+            return NULL;
+        }
+        b.node = node;
+        b.isInUse = true;
+        ptr = b.ptr;
+
+        pthread_mutex_lock(&mutex);
+        ++nAllocated;
+        bytesAllocated += b.capacity * sizeof(int32_t);
+        bytesInPool += b.capacity * sizeof(int32_t);
+        peakBytesInPool = std::max(peakBytesInPool, bytesInPool);
+        buffers.push_back(b);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // first touch of new pages happens here, on the calling thread
+    std::memset(ptr, 0, count * sizeof(int32_t));
+    return ptr;
+}
+//------------------------------------------------------------------------------
+void CountBufferPool::release(int32_t *buffer) {
+    if (NULL == buffer)
+        return;
+    pthread_mutex_lock(&mutex);
+    for (std::vector<Buffer>::iterator b = buffers.begin(); b != buffers.end();
+            ++b) {
+        if (b->ptr == buffer) {
+            b->isInUse = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return;
+}
+//------------------------------------------------------------------------------
+void CountBufferPool::print_stats(std::ostream &ost) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    pthread_mutex_lock(&mutex);
+    ost << INFO_STRING << "count buffers: acquired=" << nAcquired
+        << ", allocated=" << nAllocated << ", reused=" << nReused
+        << " (other node " << nRemoteReused << "), freed=" << nFreed
+        << ", allocated_bytes=" << bytesAllocated
+        << ", peak_pool_bytes=" << peakBytesInPool
+        << ", huge_pages=" << (isHugePages ? "on" : "off") << ENDL;
+    ost << INFO_STRING << "page faults: minor=" << usage.ru_minflt
+        << ", major=" << usage.ru_majflt << ENDL;
+    pthread_mutex_unlock(&mutex);
+    return;
+}
+//------------------------------------------------------------------------------
+CountBufferPool::CountBufferPool() {
+    pthread_mutex_init(&mutex, NULL);
+    isHugePages = false;
+    nAcquired = nAllocated = nReused = nRemoteReused = nFreed = 0;
+    bytesAllocated = bytesInPool = peakBytesInPool = 0;
+}
+//------------------------------------------------------------------------------
+CountBufferPool::~CountBufferPool() {
+    for (std::vector<Buffer>::iterator b = buffers.begin(); b != buffers.end();
+            ++b)
+        std::free(b->ptr);
+    pthread_mutex_destroy(&mutex);
+}
+//------------------------------------------------------------------------------
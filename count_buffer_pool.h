@@ -0,0 +1,47 @@
+#ifndef COUNT_BUFFER_POOL_H
+#define COUNT_BUFFER_POOL_H
+
+#include "histd.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#define EX_CBPOOL_ALIGNMENT 64
+#define EX_CBPOOL_HUGE_PAGE_SIZE 2097152
+
+//------------------------------------------------------------------------------
+// Pool of large count arrays kept across chromosomes. A buffer is acquired by
+// the worker thread that fills it, so the pages of a new buffer are first
+// touched, and placed, on the NUMA node of that worker. Free buffers are
+// handed out preferring the node of the requesting thread.
+class CountBufferPool {
+public:
+    int32_t *acquire(const size_t count);
+    void release(int32_t *buffer);
+    void set_huge_pages(const bool isEnabled) { isHugePages = isEnabled; }
+    void print_stats(std::ostream &ost);
+    CountBufferPool();
+    ~CountBufferPool();
+
+protected:
+    struct Buffer {
+        int32_t *ptr;
+        size_t capacity;  // number of elements
+        int node;         // NUMA node of the thread that first used it
+        bool isInUse;
+    };
+    int32_t *allocate(const size_t count, size_t *capacity);
+
+    std::vector<Buffer> buffers;
+    pthread_mutex_t mutex;
+    bool isHugePages;
+
+    // counters
+    long nAcquired, nAllocated, nReused, nRemoteReused, nFreed;
+    size_t bytesAllocated, bytesInPool, peakBytesInPool;
+};
+//------------------------------------------------------------------------------
+int get_current_numa_node(void);
+//------------------------------------------------------------------------------
+#endif
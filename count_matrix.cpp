@@ -0,0 +1,721 @@
+#include "count_matrix.h"
+
+#include <algorithm>
+#include <api/BamReader.h>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+bool acquire_count_matrices(ThreadCountParam *p) {
+    p->matrix = p->pool->acquire(p->matrix_length);
+    p->clipend_matrix = p->pool->acquire(p->matrix_length);
+    bool is_allocated = (NULL != p->matrix && NULL != p->clipend_matrix);
+    for (size_t t = 0; t < p->filters->size(); ++t) {
+        p->track_matrix[t] = p->pool->acquire(p->matrix_length);
+        is_allocated = is_allocated && NULL != p->track_matrix[t];
+    }
+    p->fragment_matrix = NULL;
+    if (p->is_fragment_depth) {
+        p->fragment_matrix = p->pool->acquire(p->matrix_length);
+        is_allocated = is_allocated && NULL != p->fragment_matrix;
+    }
+    if (!is_allocated) {
+        // a partial set goes back to the pool
+        p->pool->release(p->matrix);
+        p->pool->release(p->clipend_matrix);
+        for (size_t t = 0; t < p->filters->size(); ++t) {
+            p->pool->release(p->track_matrix[t]);
+            p->track_matrix[t] = NULL;
+        }
+        p->pool->release(p->fragment_matrix);
+        p->matrix = p->clipend_matrix = p->fragment_matrix = NULL;
+    }
+    return is_allocated;
+}
+//------------------------------------------------------------------------------
+// add one to [from, to) of the intervals from 'r' onward
+inline void add_depth(IntMatrixType *matrix, const TargetRegions *regions,
+        size_t r, const int from, const int to) {
+    for (; r < regions->start.size() && regions->start[r] < to; ++r) {
+        const int region_from = std::max(from, regions->start[r]);
+        const int region_to = std::min(to, regions->end[r]);
+        IntMatrixType *m = matrix + regions->offset[r] - regions->start[r];
+        for (int i = region_from; i < region_to; ++i)
+            ++(m[i]);
+    }
+}
+//------------------------------------------------------------------------------
+// the first interval ending after 'pos'
+inline size_t find_region(const TargetRegions *regions, const int pos) {
+    return std::upper_bound(regions->end.begin(), regions->end.end(), pos)
+            - regions->end.begin();
+}
+//------------------------------------------------------------------------------
+// compact index of the first target base at or after 'pos'; regions->length
+// when there is none
+inline int get_compact_index(const TargetRegions *regions, const int pos) {
+    const size_t r = find_region(regions, pos);
+    if (regions->end.size() <= r)
+        return regions->length;
+    return regions->offset[r] + std::max(0, pos - regions->start[r]);
+}
+//------------------------------------------------------------------------------
+// compact index of 'pos', or -1 when it is outside the targets
+inline int get_target_index(const TargetRegions *regions, const int pos) {
+    const size_t r = find_region(regions, pos);
+    if (regions->end.size() <= r || pos < regions->start[r])
+        return -1;
+    return regions->offset[r] + pos - regions->start[r];
+}
+//------------------------------------------------------------------------------
+// Histogram and summary of the base depth, taken by the counting thread while
+// the array is still in its cache. Trailing empty bins are dropped.
+void make_depth_stat(
+        const IntMatrixType *matrix, const int length, DepthStat *stat) {
+    stat->histogram.assign(DEPTH_HISTOGRAM_SIZE, 0);
+    long total_depth = 0;
+    double square_sum = 0;
+    IntMatrixType max_depth = 0;
+    for (int i = 0; i < length; ++i) {
+        const IntMatrixType depth = matrix[i];
+        ++(stat->histogram[std::min(depth, DEPTH_HISTOGRAM_SIZE - 1)]);
+        total_depth += depth;
+        square_sum += (double)depth * depth;
+        max_depth = std::max(max_depth, depth);
+    }
+    stat->histogram.resize(std::min(max_depth, DEPTH_HISTOGRAM_SIZE - 1) + 1);
+
+    const double mean = (0 < length) ? (double)total_depth / length : 0;
+    const double variance
+            = (0 < length) ? square_sum / length - mean * mean : 0;
+    stat->summary[EX_HDFBDR_SUMMARY_BASES] = length;
+    stat->summary[EX_HDFBDR_SUMMARY_TOTAL_DEPTH] = total_depth;
+    stat->summary[EX_HDFBDR_SUMMARY_MEAN_DEPTH] = mean;
+    stat->summary[EX_HDFBDR_SUMMARY_SD_DEPTH]
+            = std::sqrt(std::max(0.0, variance));
+    stat->summary[EX_HDFBDR_SUMMARY_MAX_DEPTH] = max_depth;
+    return;
+}
+//------------------------------------------------------------------------------
+// GetNextAlignmentCore() with its wall time added to 'decode' when given.
+// Only the monotonic clock is read per alignment, which is cheap enough.
+inline bool get_next_alignment(BamTools::BamReader &bam_reader,
+        BamTools::BamAlignment &alignment, StageCounter *decode) {
+    if (NULL == decode)
+        return bam_reader.GetNextAlignmentCore(alignment);
+    const double start = get_wall_clock();
+    const bool is_read = bam_reader.GetNextAlignmentCore(alignment);
+    decode->wallSeconds += get_wall_clock() - start;
+    if (is_read)
+        ++(decode->records);
+    return is_read;
+}
+//------------------------------------------------------------------------------
+// add one to [from, to) of a whole reference, held from position 0, or of the
+// target intervals from 'r' onward
+template <bool IS_RESTRICTED>
+inline void add_alignment_depth(IntMatrixType *matrix,
+        const TargetRegions *regions, const size_t r, const int from,
+        const int to) {
+    if (IS_RESTRICTED) {
+        add_depth(matrix, regions, r, from, to);
+        return;
+    }
+    for (int i = from; i < to; ++i)
+        ++(matrix[i]);
+}
+//------------------------------------------------------------------------------
+// Counts the alignments of the region set on 'bam_reader' (interval 'r' of
+// 'regions') and returns how many were counted. It is compiled for each
+// combination of target intervals, filtered tracks and fragment depth, so
+// that the loop tests none of them. An alignment of a single M block, which
+// most short reads are, ends at Position + Length and has no clipped end to
+// look at, so it skips GetEndPosition() and the CIGAR checks.
+template <bool IS_RESTRICTED, bool HAS_TRACKS, bool HAS_FRAGMENT>
+long count_region_alignments(ThreadCountParam *p,
+        BamTools::BamReader &bam_reader, BamTools::BamAlignment &alignment,
+        const TargetRegions *regions, const size_t r, const int fetched_end,
+        StageCounter *decode_counter, long *num_progress) {
+    int alignment_start, alignment_end, endpos, clip_index;
+    long num_counted = 0;
+    while (get_next_alignment(bam_reader, alignment, decode_counter)) {
+        if (NULL != p->stats && EX_STATS_PROGRESS_STEP == ++(*num_progress)) {
+            p->stats->add_progress(*num_progress, 0);
+            *num_progress = 0;
+        }
+        if (!alignment.IsMapped() || alignment.Position < fetched_end)
+            continue;
+        ++num_counted;
+        const std::vector<BamTools::CigarOp> &cigar = alignment.CigarData;
+        const bool is_single_block
+                = (1 == cigar.size() && 'M' == cigar[0].Type);
+        if (is_single_block) {
+            endpos = alignment.Position + cigar[0].Length;
+            alignment_start = std::max(0, alignment.Position - 1);
+            alignment_end = std::min(p->ref_length, endpos);
+        } else {
+            endpos = alignment.GetEndPosition();
+            alignment_start
+                    = std::max(0, std::min(alignment.Position, endpos) - 1);
+            alignment_end = std::min(
+                    p->ref_length, std::max(alignment.Position, endpos));
+        }
+        add_alignment_depth<IS_RESTRICTED>(
+                p->matrix, regions, r, alignment_start, alignment_end);
+
+        // filtered depth tracks share the decoded alignment
+        if (HAS_TRACKS) {
+            for (size_t t = 0; t < p->filters->size(); ++t) {
+                if (!(*p->filters)[t].is_passed(alignment))
+                    continue;
+                add_alignment_depth<IS_RESTRICTED>(p->track_matrix[t],
+                        regions, r, alignment_start, alignment_end);
+            }
+        }
+
+        // soft-clipped read ends
+        if (!is_single_block && !cigar.empty()) {
+            const BamTools::CigarOp &first = cigar.front();
+            const BamTools::CigarOp &last = cigar.back();
+            if ('S' == first.Type && p->ref_length > alignment.Position
+                    && 0 <= endpos
+                    && 0 <= (clip_index = get_target_index(
+                                     regions, alignment.Position)))
+                p->clipend_matrix[clip_index] += first.Length;
+            if ('S' == last.Type && p->ref_length > endpos && 0 <= endpos
+                    && 0 <= (clip_index = get_target_index(regions, endpos)))
+                p->clipend_matrix[clip_index] += last.Length;
+        }
+
+        // fragment coverage events; each template is counted once from
+        // the leftmost mate, which carries the positive insert size.
+        // Events are moved to the next target base so that the running
+        // sum over the compact array gives the depth of each target base.
+        if (HAS_FRAGMENT && alignment.IsProperPair()
+                && alignment.IsPrimaryAlignment()
+                && 0 == (alignment.AlignmentFlag
+                                & EX_ALNFLT_FLAG_SUPPLEMENTARY)
+                && alignment.RefID == alignment.MateRefID
+                && 0 < alignment.InsertSize) {
+            const int fragment_start = std::max(0, alignment.Position - 1);
+            const int fragment_end = alignment.Position + alignment.InsertSize;
+            if (fragment_start < p->ref_length) {
+                const int start_index
+                        = get_compact_index(regions, fragment_start);
+                const int end_index = (fragment_end < p->ref_length)
+                        ? get_compact_index(regions, fragment_end)
+                        : regions->length;
+                if (start_index < regions->length)
+                    ++(p->fragment_matrix[start_index]);
+                if (end_index < regions->length)
+                    --(p->fragment_matrix[end_index]);
+            }
+        }
+
+        // count unique reads
+        if (alignment.IsPrimaryAlignment())
+            ++(p->unique_read_count);
+    }
+    return num_counted;
+}
+//------------------------------------------------------------------------------
+typedef long (*CountRegionFunc)(ThreadCountParam *p,
+        BamTools::BamReader &bam_reader, BamTools::BamAlignment &alignment,
+        const TargetRegions *regions, const size_t r, const int fetched_end,
+        StageCounter *decode_counter, long *num_progress);
+//------------------------------------------------------------------------------
+template <bool IS_RESTRICTED, bool HAS_TRACKS>
+CountRegionFunc select_count_region(const bool has_fragment) {
+    if (has_fragment)
+        return count_region_alignments<IS_RESTRICTED, HAS_TRACKS, true>;
+    return count_region_alignments<IS_RESTRICTED, HAS_TRACKS, false>;
+}
+//------------------------------------------------------------------------------
+// the counting loop compiled for the options of a thread
+CountRegionFunc select_count_region(const ThreadCountParam *p) {
+    const bool has_tracks = !p->filters->empty();
+    const bool has_fragment = (NULL != p->fragment_matrix);
+    if (NULL != p->regions) {
+        return has_tracks ? select_count_region<true, true>(has_fragment)
+                          : select_count_region<true, false>(has_fragment);
+    }
+    return has_tracks ? select_count_region<false, true>(has_fragment)
+                      : select_count_region<false, false>(has_fragment);
+}
+//------------------------------------------------------------------------------
+// Stages of a chromosome: zero (buffer acquisition), bam_decode, count (the
+// rest of the alignment loop and the fragment sum), depth_stat and
+// count_thread (the whole thread). bam_decode and count have no CPU time of
+// their own, as reading the thread CPU clock per alignment is a system call.
+void *thread_make_matrix(void *arg) {
+    ThreadCountParam *p = (ThreadCountParam *)arg;
+    StageTimer thread_timer, timer;
+    StageCounter zero, decode, count, depth_stat, thread_total;
+    StageCounter *decode_counter = (NULL == p->stats) ? NULL : &decode;
+    // no clock is read unless stats are taken
+    const bool is_timed = (NULL != p->stats);
+    long num_counted = 0, num_progress = 0;
+    if (is_timed)
+        thread_timer.start();
+
+    // zeroed on this thread so that the pages are local to it
+    if (is_timed)
+        timer.start();
+    p->is_failed = false;
+    p->is_allocated = acquire_count_matrices(p);
+    if (!p->is_allocated)
+        return NULL;
+    if (is_timed) {
+        timer.stop(&zero,
+                (long)p->matrix_length * sizeof(IntMatrixType)
+                        * (2 + p->filters->size()
+                                + (p->is_fragment_depth ? 1 : 0)),
+                p->matrix_length);
+    }
+
+    // open the input bam & index files
+    BamTools::BamReader bam_reader;
+    if (!bam_reader.Open(p->input_fn)) {
+        std::cerr << ERROR_STRING << "bam_reader.Open() failed at line "
+                  << __LINE__ << ". input_fn=" << p->input_fn << ENDL;
+        p->is_failed = true;
+        return NULL;
+    }
+    if (!bam_reader.LocateIndex(BamTools::BamIndex::STANDARD))
+        bam_reader.CreateIndex();
+
+    // the whole reference is a single target interval
+    TargetRegions whole;
+    const TargetRegions *regions = p->regions;
+    if (NULL == regions) {
+        whole.start.push_back(p->ref_start);
+        whole.end.push_back(p->ref_end);
+        whole.offset.push_back(0);
+        whole.length = p->ref_end - p->ref_start;
+        regions = &whole;
+    }
+
+    int refid = bam_reader.GetReferenceID(p->ref_name);
+    const CountRegionFunc count_region = select_count_region(p);
+    BamTools::BamAlignment alignment;
+
+    // An alignment also adds depth to the base before its start, so each
+    // region is extended by one base to the right. Alignments already fetched
+    // for the previous interval are skipped by their start position.
+    int fetched_end = 0;
+    const double loop_start = is_timed ? get_wall_clock() : 0;
+    for (size_t r = 0; r < regions->start.size(); ++r) {
+        const int region_end = std::min(p->ref_length, regions->end[r] + 1);
+        if (!bam_reader.SetRegion(
+                    refid, regions->start[r], refid, region_end)) {
+            std::cerr << ERROR_STRING << "failed to set a region of '"
+                      << p->ref_name << "' in " << p->input_fn << "." << ENDL;
+            p->is_failed = true;
+            return NULL;
+        }
+        num_counted += count_region(p, bam_reader, alignment, regions, r,
+                fetched_end, decode_counter, &num_progress);
+        fetched_end = region_end;
+    }
+
+    // fragment depth from the accumulated start/end events
+    if (NULL != p->fragment_matrix) {
+        for (int i = 1; i < p->matrix_length; ++i)
+            p->fragment_matrix[i] += p->fragment_matrix[i - 1];
+    }
+    const double loop_seconds = is_timed ? get_wall_clock() - loop_start : 0;
+    if (is_timed)
+        timer.start();
+    make_depth_stat(p->matrix, p->matrix_length, &p->depth_stat);
+    if (is_timed) {
+        timer.stop(&depth_stat,
+                (long)p->matrix_length * sizeof(IntMatrixType),
+                p->matrix_length);
+    }
+
+    bam_reader.Close();
+    if (is_timed) {
+        decode.cpuSeconds = count.cpuSeconds = -1;
+        decode.calls = count.calls = 1;
+        count.wallSeconds = loop_seconds - decode.wallSeconds;
+        count.records = num_counted;
+        thread_timer.stop(&thread_total, 0, num_counted);
+        p->stats->add("zero", p->thread_name, p->ref_name, zero);
+        p->stats->add("bam_decode", p->thread_name, p->ref_name, decode);
+        p->stats->add("count", p->thread_name, p->ref_name, count);
+        p->stats->add("depth_stat", p->thread_name, p->ref_name, depth_stat);
+        p->stats->add(
+                "count_thread", p->thread_name, p->ref_name, thread_total);
+        p->stats->add_progress(num_progress, 1);
+    }
+    return NULL;
+}
+//------------------------------------------------------------------------------
+BamTools::RefVector get_refvector(const std::string &input_fn) {
+    // open the input bam & index files
+    BamTools::BamReader bam_reader;
+    if (!bam_reader.Open(input_fn)) {
+        std::cerr << ERROR_STRING << "bam_reader.Open() failed at line "
+                  << __LINE__ << ". input_fn=" << input_fn << ENDL;
+        BamTools::RefVector dummy;
+        return dummy;
+    }
+    if (!bam_reader.LocateIndex(BamTools::BamIndex::STANDARD))
+        bam_reader.CreateIndex();
+
+    BamTools::RefVector refvector = bam_reader.GetReferenceData();
+    bam_reader.Close();
+
+    return refvector;
+}
+//------------------------------------------------------------------------------
+bool write_chunked_dataset(H5::H5File *file, const std::string &path,
+        const IntMatrixType *matrix, const int *szMatrix) {
+    int rank = 1;
+    hsize_t dims[2], cdims[2];
+    H5::DataSet *dataset;
+
+    dims[0] = *szMatrix;
+    cdims[0] = std::min(CHUNK_SIZE, *szMatrix);
+    H5::DataSpace dataspace(rank, dims);
+
+    H5::DSetCreatPropList ds_creatplist;
+    ds_creatplist.setChunk(rank, cdims);
+    ds_creatplist.setDeflate(5);
+
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(path.c_str(),
+                H5::PredType::STD_I32LE, dataspace, ds_creatplist));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << path
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(matrix, H5::PredType::STD_I32LE, dataspace);
+    delete dataset;
+    return true;
+}
+//------------------------------------------------------------------------------
+// Arrays of a sparse track; small ones are kept in the object header
+// (compact layout) to avoid the chunk index overhead, larger ones are
+// shuffled and deflated.
+bool write_sparse_dataset(H5::H5File *file, const std::string &path,
+        const IntMatrixType *data, const int num_items) {
+    int rank = 1;
+    hsize_t dims[2], cdims[2];
+    dims[0] = num_items;
+    cdims[0] = std::min(CHUNK_SIZE, num_items);
+    H5::DataSpace dataspace(rank, dims);
+
+    H5::DSetCreatPropList ds_creatplist;
+    if (SPARSE_COMPACT_SIZE >= num_items) {
+        ds_creatplist.setLayout(H5D_COMPACT);
+    } else {
+        ds_creatplist.setChunk(rank, cdims);
+        ds_creatplist.setShuffle();
+        ds_creatplist.setDeflate(5);
+    }
+
+    try {
+        H5::Exception::dontPrint();
+        H5::DataSet dataset = file->createDataSet(path.c_str(),
+                H5::PredType::STD_I32LE, dataspace, ds_creatplist);
+        if (0 < num_items)
+            dataset.write(data, H5::PredType::STD_I32LE, dataspace);
+    } catch (H5::Exception err) {
+        std::cerr << ERROR_STRING << "dataset '" << path
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// Write a track as a dense array, or as a group of Position/Value arrays when
+// a coordinate/value or run-length encoding is much smaller
+// -- Added in the matrix Version 0.4
+bool write_track(H5::H5File *file, const std::string &path,
+        const IntMatrixType *matrix, const int *szMatrix,
+        const bool is_sparse) {
+    if (!is_sparse || 0 >= *szMatrix)
+        return write_chunked_dataset(file, path, matrix, szMatrix);
+
+    int num_nonzero = (0 != matrix[0]), num_runs = 1;
+    for (int i = 1; i < *szMatrix; ++i) {
+        num_nonzero += (0 != matrix[i]);
+        num_runs += (matrix[i] != matrix[i - 1]);
+    }
+    const bool is_coo = (num_nonzero <= num_runs);
+    const long sparse_size = 2L * (is_coo ? num_nonzero : num_runs);
+    if (sparse_size * SPARSE_RATIO >= *szMatrix)
+        return write_chunked_dataset(file, path, matrix, szMatrix);
+
+    std::vector<IntMatrixType> positions, values;
+    positions.reserve(sparse_size / 2);
+    values.reserve(sparse_size / 2);
+    for (int i = 0; i < *szMatrix; ++i) {
+        if (is_coo ? (0 != matrix[i])
+                   : (0 == i || matrix[i] != matrix[i - 1])) {
+            positions.push_back(i);
+            values.push_back(matrix[i]);
+        }
+    }
+
+    try {
+        H5::Exception::dontPrint();
+        H5::Group group = file->createGroup(path.c_str());
+        const std::string encoding
+                = is_coo ? EX_HDFBDR_ENCODING_COO : EX_HDFBDR_ENCODING_RLE;
+        H5::StrType strtype(H5::PredType::C_S1, encoding.length());
+        H5::DataSpace scalar(H5S_SCALAR);
+        H5::Attribute attr = group.createAttribute(
+                EX_HDFBDR_ENCODING_ATTR, strtype, scalar);
+        attr.write(strtype, encoding.c_str());
+        H5::Attribute length_attr = group.createAttribute(
+                EX_HDFBDR_SPARSE_LENGTH_ATTR, H5::PredType::STD_I32LE, scalar);
+        length_attr.write(H5::PredType::STD_I32LE, szMatrix);
+    } catch (H5::Exception err) {
+        std::cerr << ERROR_STRING << "group '" << path << "' can't open."
+                  << ENDL;
+        return false;
+    }
+
+    const int num_items = positions.size();
+    return write_sparse_dataset(file, path + "/" EX_HDFBDR_SPARSE_POSITION,
+                   positions.data(), num_items)
+            && write_sparse_dataset(file, path + "/" EX_HDFBDR_SPARSE_VALUE,
+                    values.data(), num_items);
+}
+//------------------------------------------------------------------------------
+bool write_hdf(H5::H5File *file, const char *ref_name,
+        const IntMatrixType *matrix, const IntMatrixType *clipend_matrix,
+        const int *szMatrix, const int *unique_read_count,
+        const AlignmentFilterArray &filters,
+        IntMatrixType *const *track_matrix,
+        const IntMatrixType *fragment_matrix, const bool is_sparse,
+        const TargetRegions *regions, const DepthStat *depth_stat) {
+    int rank = 1;
+    hsize_t dims[2];
+    H5::Group *group;
+    H5::DataSet *dataset;
+
+    // group for depth matrix
+    std::stringstream fstr;
+    fstr << "/" << ref_name;
+    try {
+        H5::Exception::dontPrint();
+        group = new H5::Group(file->createGroup(fstr.str().c_str()));
+    } catch (H5::GroupIException err) {
+        std::cerr << ERROR_STRING << "group '" << fstr.str() << "' can't open."
+                  << ENDL;
+        return false;
+    }
+
+    // write name
+    fstr << "/FullName";
+    dims[0] = std::strlen(ref_name);
+    H5::DataSpace dataspace(rank, dims);
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(
+                fstr.str().c_str(), H5::PredType::C_S1, dataspace));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(ref_name, H5::PredType::C_S1, dataspace);
+    delete dataset;
+
+    // write length
+    fstr.str("/");
+    fstr << ref_name << "/Length";
+    dims[0] = 1;
+    H5::DataSpace dataspace2(rank, dims);
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(
+                fstr.str().c_str(), H5::PredType::STD_I32LE, dataspace2));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(szMatrix, H5::PredType::STD_I32LE, dataspace2);
+    delete dataset;
+
+    // unique read count -- Added in the matrix Version 0.2
+    fstr.str("/");
+    fstr << ref_name << "/UniqueReadCount";
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(
+                fstr.str().c_str(), H5::PredType::STD_I32LE, dataspace2));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(unique_read_count, H5::PredType::STD_I32LE, dataspace2);
+    delete dataset;
+
+    // depth histogram and summary of the counted bases -- Added in the matrix
+    // Version 0.6
+    fstr.str("/");
+    fstr << ref_name << "/" EX_HDFBDR_DEPTH_HISTOGRAM;
+    dims[0] = depth_stat->histogram.size();
+    H5::DataSpace dataspace3(rank, dims);
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(
+                fstr.str().c_str(), H5::PredType::STD_I32LE, dataspace3));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(depth_stat->histogram.data(), H5::PredType::STD_I32LE,
+            dataspace3);
+    delete dataset;
+
+    fstr.str("/");
+    fstr << ref_name << "/" EX_HDFBDR_DEPTH_SUMMARY;
+    dims[0] = EX_HDFBDR_SUMMARY_SIZE;
+    H5::DataSpace dataspace4(rank, dims);
+    try {
+        H5::Exception::dontPrint();
+        dataset = new H5::DataSet(file->createDataSet(
+                fstr.str().c_str(), H5::PredType::IEEE_F64LE, dataspace4));
+    } catch (H5::DataSetIException err) {
+        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
+                  << "' can't open. func_name='" << err.getFuncName()
+                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
+        return false;
+    }
+    dataset->write(depth_stat->summary, H5::PredType::NATIVE_DOUBLE,
+            dataspace4);
+    delete dataset;
+
+    // target intervals of a restricted matrix -- Added in the matrix Version
+    // 0.5. Tracks then hold the bases of these intervals back to back.
+    int track_length = *szMatrix;
+    if (NULL != regions) {
+        track_length = regions->length;
+        const int num_regions = regions->start.size();
+        fstr.str("/");
+        fstr << ref_name << "/" EX_HDFBDR_REGION_START;
+        if (!write_chunked_dataset(
+                    file, fstr.str(), regions->start.data(), &num_regions))
+            return false;
+        fstr.str("/");
+        fstr << ref_name << "/" EX_HDFBDR_REGION_END;
+        if (!write_chunked_dataset(
+                    file, fstr.str(), regions->end.data(), &num_regions))
+            return false;
+        fstr.str("/");
+        fstr << ref_name << "/" EX_HDFBDR_REGION_OFFSET;
+        if (!write_chunked_dataset(
+                    file, fstr.str(), regions->offset.data(), &num_regions))
+            return false;
+    }
+
+    // base depth
+    fstr.str("/");
+    fstr << ref_name << "/BaseDepth";
+    if (!write_track(file, fstr.str(), matrix, &track_length, is_sparse))
+        return false;
+
+    // clip-end counts at the detected positions
+    fstr.str("/");
+    fstr << ref_name << "/ClipEndCount";
+    if (!write_track(
+                file, fstr.str(), clipend_matrix, &track_length, is_sparse))
+        return false;
+
+    // filtered depth tracks
+    for (size_t t = 0; t < filters.size(); ++t) {
+        fstr.str("/");
+        fstr << ref_name << "/BaseDepth." << filters[t].name;
+        if (!write_track(file, fstr.str(), track_matrix[t], &track_length,
+                    is_sparse))
+            return false;
+    }
+
+    // fragment coverage
+    if (NULL != fragment_matrix) {
+        fstr.str("/");
+        fstr << ref_name << "/FragmentDepth";
+        if (!write_track(file, fstr.str(), fragment_matrix, &track_length,
+                    is_sparse))
+            return false;
+    }
+
+    // completion mark -- Added in the matrix Version 0.3
+    // written last so that a group without it is known to be incomplete
+    const int complete = 1;
+    H5::DataSpace scalar(H5S_SCALAR);
+    H5::Attribute attr = group->createAttribute(
+            COMPLETE_ATTR_NAME, H5::PredType::STD_I32LE, scalar);
+    attr.write(H5::PredType::STD_I32LE, &complete);
+    attr.close();
+    delete group;
+
+    // keep the finished chromosomes on disk in case of a later crash
+    file->flush(H5F_SCOPE_GLOBAL);
+    return true;
+}
+//------------------------------------------------------------------------------
+H5::H5File *open_output(const std::string &output_fn, const int output_mode,
+        bool *is_legacy) {
+    H5::H5File *file = NULL;
+    *is_legacy = false;
+    const bool is_existing = (0 == access(output_fn.c_str(), F_OK));
+    try {
+        H5::Exception::dontPrint();
+        if (OUTPUT_MODE_CREATE != output_mode && is_existing) {
+            file = new H5::H5File(output_fn.c_str(), H5F_ACC_RDWR);
+            // matrices before Version 0.3 have no completion marks
+            *is_legacy = (0 >= H5Aexists(file->getId(), "Version"));
+            return file;
+        }
+        file = new H5::H5File(output_fn.c_str(), H5F_ACC_TRUNC);
+    } catch (H5::FileIException err) {
+        std::cerr << "The output matrix (" << output_fn
+                  << ") can't open for writing." << ENDL;
+        return NULL;
+    }
+
+    // matrix version
+    H5::StrType strtype(H5::PredType::C_S1, std::strlen(MATRIX_VERSION));
+    H5::DataSpace scalar(H5S_SCALAR);
+    H5::Group root = file->openGroup("/");
+    H5::Attribute attr = root.createAttribute("Version", strtype, scalar);
+    attr.write(strtype, MATRIX_VERSION);
+    return file;
+}
+//------------------------------------------------------------------------------
+void get_count_matrices(
+        const ThreadCountParam *p, std::vector<IntMatrixType *> &buffers) {
+    buffers.push_back(p->matrix);
+    buffers.push_back(p->clipend_matrix);
+    for (size_t t = 0; t < p->filters->size(); ++t)
+        buffers.push_back(p->track_matrix[t]);
+    buffers.push_back(p->fragment_matrix);
+}
+//------------------------------------------------------------------------------
+void release_count_matrices(
+        CountBufferPool *pool, std::vector<IntMatrixType *> &buffers) {
+    for (std::vector<IntMatrixType *>::const_iterator b = buffers.begin();
+            b != buffers.end(); ++b)
+        pool->release(*b);
+    buffers.clear();
+}
@@ -0,0 +1,99 @@
+#ifndef COUNT_MATRIX_H
+#define COUNT_MATRIX_H
+
+#include "histd.h"
+
+#include "alignment_filter.h"
+#include "count_buffer_pool.h"
+#include "hdf_base_depth_reader.h"
+#include "stage_stats.h"
+
+#include <H5Cpp.h>
+#include <api/BamAux.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define CHUNK_SIZE 65536
+#define MATRIX_VERSION "0.6"
+#define COMPLETE_ATTR_NAME "Complete"
+
+// output modes
+#define OUTPUT_MODE_CREATE 0
+#define OUTPUT_MODE_RESUME 1
+#define OUTPUT_MODE_APPEND 2
+
+// a sparse encoding is used when it needs this many times fewer elements;
+// deflate already packs moderately sparse dense arrays well
+#define SPARSE_RATIO 32
+// sparse arrays up to this many elements use the compact layout
+#define SPARSE_COMPACT_SIZE 4096
+
+// bins of the depth histogram; the last one holds all deeper bases
+#define DEPTH_HISTOGRAM_SIZE 1024
+
+typedef int32_t IntMatrixType;
+//------------------------------------------------------------------------------
+// Target intervals of one reference as sorted, merged half-open ranges of
+// matrix indices. Depth is kept only for these, one interval after another,
+// and offset gives the position of each interval in the compact arrays.
+struct TargetRegions {
+    std::vector<int> start, end, offset;
+    int length;  // total number of bases in the intervals
+};
+typedef std::map<std::string, TargetRegions> TargetRegionsDB;
+//------------------------------------------------------------------------------
+// distribution of the base depth over the counted bases
+struct DepthStat {
+    std::vector<IntMatrixType> histogram;
+    double summary[EX_HDFBDR_SUMMARY_SIZE];
+};
+//------------------------------------------------------------------------------
+struct ThreadCountParam {
+    std::string input_fn, ref_name;
+    int ref_index, ref_start, ref_end, ref_length, unique_read_count;
+    // target intervals; NULL to count the whole reference
+    const TargetRegions *regions;
+    int matrix_length;
+    IntMatrixType *matrix, *clipend_matrix;
+    // filtered depth tracks, one matrix per filter
+    const AlignmentFilterArray *filters;
+    IntMatrixType **track_matrix;
+    // fragment (insert) coverage of proper pairs; NULL when disabled
+    IntMatrixType *fragment_matrix;
+    bool is_fragment_depth, is_sparse;
+    // count matrices are taken from the pool by the counting thread
+    CountBufferPool *pool;
+    bool is_allocated;
+    // counting failed, e.g. the BAM can't be opened; the matrices must not be
+    // written and are only released
+    bool is_failed;
+    DepthStat depth_stat;
+    // per-stage counters; NULL unless --stats or --progress is given
+    StageStats *stats;
+    std::string thread_name;
+};
+//------------------------------------------------------------------------------
+// counting of one reference by thread_make_matrix() and writing of its tracks
+// by write_hdf(), shared by create_read_count_matrix and tbkm_bench
+bool acquire_count_matrices(ThreadCountParam *p);
+void get_count_matrices(
+        const ThreadCountParam *p, std::vector<IntMatrixType *> &buffers);
+void release_count_matrices(
+        CountBufferPool *pool, std::vector<IntMatrixType *> &buffers);
+void make_depth_stat(
+        const IntMatrixType *matrix, const int length, DepthStat *stat);
+void *thread_make_matrix(void *arg);
+BamTools::RefVector get_refvector(const std::string &input_fn);
+bool write_hdf(H5::H5File *file, const char *ref_name,
+        const IntMatrixType *matrix, const IntMatrixType *clipend_matrix,
+        const int *szMatrix, const int *unique_read_count,
+        const AlignmentFilterArray &filters,
+        IntMatrixType *const *track_matrix,
+        const IntMatrixType *fragment_matrix, const bool is_sparse,
+        const TargetRegions *regions, const DepthStat *depth_stat);
+H5::H5File *open_output(const std::string &output_fn, const int output_mode,
+        bool *is_legacy);
+//------------------------------------------------------------------------------
+
+#endif
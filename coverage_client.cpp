@@ -0,0 +1,178 @@
+#include "histd.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define EX_COVC_BUFFER_SIZE 65536
+//------------------------------------------------------------------------------
+int connect_server(const std::string &socketFn) {
+    struct sockaddr_un address;
+    if (sizeof(address.sun_path) <= socketFn.length()) {
+        std::cerr << ERROR_STRING << "the socket path (" << socketFn
+                  << ") is too long." << ENDL;
+        return -1;
+    }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketFn.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > fd
+            || 0 > connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        std::cerr << ERROR_STRING << "can't connect to a coverage server on "
+                  << socketFn << " (" << std::strerror(errno) << ")." << ENDL;
+        if (0 <= fd)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+//------------------------------------------------------------------------------
+// Send the queries and copy the answers to stdout at the same time, so that
+// neither side blocks on a full socket buffer with a large batch.
+bool exchange(const int fd, const int inputFd, const std::string &prologue) {
+    char *buffer = new char[EX_COVC_BUFFER_SIZE];
+    std::string outgoing = prologue;
+    bool isInputOpen = true, isSuccess = true;
+    while (true) {
+        struct pollfd fds[2];
+        int nfds = 1;
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | (outgoing.empty() ? 0 : POLLOUT);
+        if (isInputOpen && outgoing.empty()) {
+            fds[1].fd = inputFd;
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
+        if (0 > poll(fds, nfds, -1)) {
+            if (EINTR == errno)
+                continue;
+            isSuccess = false;
+            break;
+        }
+
+        // answers
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            const ssize_t n = read(fd, buffer, EX_COVC_BUFFER_SIZE);
+            if (0 > n && EINTR == errno)
+                continue;
+            if (0 >= n) {
+                isSuccess = (0 == n);
+                break;
+            }
+            std::cout.write(buffer, n);
+        }
+        // queries
+        if (!outgoing.empty() && (fds[0].revents & POLLOUT)) {
+            const ssize_t n = write(fd, outgoing.c_str(), outgoing.length());
+            if (0 > n && EINTR != errno) {
+                isSuccess = false;
+                break;
+            }
+            if (0 < n)
+                outgoing.erase(0, n);
+        }
+        if (2 == nfds && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            const ssize_t n = read(inputFd, buffer, EX_COVC_BUFFER_SIZE);
+            if (0 > n && EINTR == errno)
+                continue;
+            if (0 >= n) {
+                // end of the queries; the server closes after the answers
+                isInputOpen = false;
+                shutdown(fd, SHUT_WR);
+            } else {
+                outgoing.append(buffer, n);
+            }
+        }
+    }
+    std::cout.flush();
+    delete[] buffer;
+    if (!isSuccess) {
+        std::cerr << ERROR_STRING << "connection to the server was lost."
+                  << ENDL;
+    }
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+void print_usage(const char *cmd) {
+    std::cerr << USAGE_STRING << cmd << " (options) -S socket" << ENDL;
+    std::cerr << "Available options:" << ENDL;
+    std::cerr << " -S  Unix domain socket of 'gff_coverage -S' [MANDATORY]"
+              << ENDL;
+    std::cerr << " -i  query file [stdin]" << ENDL;
+    std::cerr << " -m  min read depth to consider 'covered' [server setting]"
+              << ENDL
+              << ENDL;
+    std::cerr << "A query is a GFF record or 'seqid<TAB>start<TAB>end' "
+                 "(1-based, inclusive) per line. Answers"
+              << ENDL
+              << "are written in the gff_coverage format; '#invalid' and "
+                 "'#skipped' lines report"
+              << ENDL
+              << "queries that were not answered." << ENDL << ENDL;
+    return;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    std::string socketFn = "", queryFn = "", prologue = "";
+    // parse arguments
+    char option;
+    while ((option = getopt(argc, argv, "S:i:m:h")) != -1) {
+        switch (option) {
+            case 'S':
+                socketFn = optarg;
+                break;
+            case 'i':
+                queryFn = optarg;
+                break;
+            case 'm':
+                prologue = std::string("#minDepth\t") + optarg + "\n";
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                std::cerr << WARNING_STRING
+                          << "unknown option specified and ignored." << ENDL;
+                break;
+        }
+    }
+
+    // check mandatory arguments
+    if (socketFn.empty()) {
+        std::cerr << ERROR_STRING << "a socket (-S) is mandatory." << ENDL
+                  << ENDL;
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int inputFd = STDIN_FILENO;
+    if (!queryFn.empty()) {
+        inputFd = open(queryFn.c_str(), O_RDONLY);
+        if (0 > inputFd) {
+            std::cerr << ERROR_STRING << "failed to open the query file ("
+                      << queryFn << ")." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const int fd = connect_server(socketFn);
+    if (0 > fd) {
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    const bool isSuccess = exchange(fd, inputFd, prologue);
+    close(fd);
+    if (STDIN_FILENO != inputFd)
+        close(inputFd);
+    exit(isSuccess ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+//------------------------------------------------------------------------------
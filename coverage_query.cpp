@@ -0,0 +1,277 @@
+#include "coverage_query.h"
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+// depth summed run by run, as read from a sparse track
+void add_run_sum(const std::vector<int> &runStart,
+        const std::vector<IntType> &runValue, const int end,
+        const int minDepth, int *coveredBases, long *totalDepth) {
+    for (size_t i = 0; i < runStart.size(); ++i) {
+        const int runEnd = (i + 1 < runStart.size()) ? runStart[i + 1] : end;
+        if (minDepth <= runValue[i]) {
+            *coveredBases += runEnd - runStart[i];
+        }
+        *totalDepth += (long)runValue[i] * (runEnd - runStart[i]);
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+void add_matrix_sum(const IntType *matrix, const int szRegion,
+        const int minDepth, int *coveredBases, long *totalDepth) {
+    long totalDP = 0;
+    for (int pos = 0; pos < szRegion; ++pos) {
+        if (minDepth <= matrix[pos]) {
+            *coveredBases += 1;
+        }
+        totalDP += matrix[pos];
+    }
+    *totalDepth += totalDP;
+    return;
+}
+//------------------------------------------------------------------------------
+bool get_cover_sum(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        long *totalDepth, CoverBuffer &buffer) {
+    // sparse tracks are summed run by run without expanding them
+    if (hdf.is_sparse()) {
+        if (!hdf.get_runs(
+                    start, szRegion, buffer.runStart, buffer.runValue)) {
+            std::cerr << WARNING_STRING
+                      << "failed to fetch a matrix. start=" << *start
+                      << ", size=" << *szRegion << ENDL;
+            return false;
+        }
+        add_run_sum(buffer.runStart, buffer.runValue, *start + *szRegion,
+                minDepth, coveredBases, totalDepth);
+        return true;
+    }
+
+    if (buffer.matrix.size() < (size_t)*szRegion)
+        buffer.matrix.resize(*szRegion);
+    if (!hdf.get_matrix(start, szRegion, buffer.matrix.data())) {
+        std::cerr << WARNING_STRING
+                  << "failed to fetch a matrix. start=" << *start
+                  << ", size=" << *szRegion << ENDL;
+        return false;
+    }
+    add_matrix_sum(buffer.matrix.data(), *szRegion, minDepth, coveredBases,
+            totalDepth);
+    return true;
+}
+//------------------------------------------------------------------------------
+bool get_cover_sum(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        long *totalDepth) {
+    static thread_local CoverBuffer buffer;
+    return get_cover_sum(
+            hdf, start, szRegion, coveredBases, minDepth, totalDepth, buffer);
+}
+//------------------------------------------------------------------------------
+bool get_cover_stat(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        float *avgDepth) {
+    long totalDP = 0;
+    if (!get_cover_sum(
+                hdf, start, szRegion, coveredBases, minDepth, &totalDP))
+        return false;
+    *avgDepth = (float)totalDP / (float)*szRegion;
+    return true;
+}
+//------------------------------------------------------------------------------
+class RegionLess {
+public:
+    explicit RegionLess(const CoverageRegionArray &r) : regions(r) {}
+    bool operator()(const int left, const int right) const {
+        if (regions[left].seqid != regions[right].seqid)
+            return regions[left].seqid < regions[right].seqid;
+        if (regions[left].start != regions[right].start)
+            return regions[left].start < regions[right].start;
+        return left < right;
+    }
+
+private:
+    const CoverageRegionArray &regions;
+};
+//------------------------------------------------------------------------------
+bool CoverageQuery::open(const hi::StringArray &matrixFiles) {
+    close();
+    lock_hdf();
+    bool isError = false;
+    for (hi::StringArray::const_iterator fn = matrixFiles.begin();
+            fn != matrixFiles.end(); ++fn) {
+        HdfBaseDepthReader *hdf = new HdfBaseDepthReader;
+        if (!hdf->open(fn->c_str())) {
+            std::cerr << WARNING_STRING << "failed to open an input HDF ("
+                      << *fn << "). [code: " << __LINE__ << "]" << ENDL;
+            isError = true;
+        }
+        hdfs.push_back(hdf);
+        currentChrom.push_back("");
+    }
+    unlock_hdf();
+    return !isError;
+}
+//------------------------------------------------------------------------------
+void CoverageQuery::close(void) {
+    lock_hdf();
+    for (size_t i = 0; i < hdfs.size(); ++i) {
+        hdfs[i]->close();
+        delete hdfs[i];
+    }
+    unlock_hdf();
+    hdfs.clear();
+    currentChrom.clear();
+}
+//------------------------------------------------------------------------------
+// depth track to query, e.g. BaseDepth.q20 [BaseDepth]
+void CoverageQuery::set_dataset(const std::string &name) {
+    if (name == dataName)
+        return;
+    dataName = name;
+    std::fill(currentChrom.begin(), currentChrom.end(), "");
+}
+//------------------------------------------------------------------------------
+// A failed switch clears the cached name so that the next query retries.
+bool CoverageQuery::set_chromosome(const int sample, const std::string &seqid) {
+    if (seqid == currentChrom[sample])
+        return true;
+    currentChrom[sample] = "";
+    lock_hdf();
+    const bool isSuccess = hdfs[sample]->set_target_chromosome(seqid.c_str())
+            && hdfs[sample]->set_target_dataset(
+                    dataName.c_str(), H5::PredType::STD_I32LE);
+    unlock_hdf();
+    if (!isSuccess)
+        return false;
+    currentChrom[sample] = seqid;
+    return true;
+}
+//------------------------------------------------------------------------------
+// same as get_cover_sum(), reading under the HDF5 mutex and summing outside;
+// long regions of dense tracks are read as raw chunks and inflated outside
+bool CoverageQuery::add_region_sum(const int sample, const int start,
+        const int szRegion, CoverageStat *stat) {
+    HdfBaseDepthReader *hdf = hdfs[sample];
+    bool isSuccess;
+    lock_hdf();
+    const bool isSparse = hdf->is_sparse();
+    const bool isRaw = !isSparse && hdf->can_read_raw_chunks()
+            && EX_HDFBDR_INFLATE_MIN_CHUNKS * hdf->get_chunk_size()
+                    <= szRegion;
+    if (!isSparse && buffer.size() < (size_t)szRegion)
+        buffer.resize(szRegion);
+    if (isSparse) {
+        isSuccess = hdf->get_runs(&start, &szRegion, runStart, runValue);
+    } else if (isRaw) {
+        isSuccess = hdf->read_raw_chunks(&start, &szRegion, rawChunks);
+    } else {
+        isSuccess = hdf->get_matrix(&start, &szRegion, buffer.data());
+    }
+    unlock_hdf();
+    if (isSuccess && isRaw)
+        isSuccess = inflate_chunks(rawChunks, buffer.data(), inflateThreads);
+    if (!isSuccess) {
+        std::cerr << WARNING_STRING
+                  << "failed to fetch a matrix. start=" << start
+                  << ", size=" << szRegion << ENDL;
+        return false;
+    }
+
+    if (isSparse) {
+        add_run_sum(runStart, runValue, start + szRegion, minDepth,
+                &stat->coveredBases, &stat->totalDepth);
+    } else {
+        add_matrix_sum(buffer.data(), szRegion, minDepth,
+                &stat->coveredBases, &stat->totalDepth);
+    }
+    if (NULL != stats) {
+        queryCounter.bytes += isSparse
+                ? (long)runStart.size() * (sizeof(int) + sizeof(IntType))
+                : (long)szRegion * sizeof(IntType);
+        ++queryCounter.records;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+void CoverageQuery::flush_stats(const std::string &seqid) {
+    if (NULL == stats)
+        return;
+    queryTimer.stop(&queryCounter, 0, 0);
+    stats->add("query", threadName, seqid, queryCounter);
+    queryCounter.clear();
+}
+//------------------------------------------------------------------------------
+bool CoverageQuery::query(const CoverageRegionArray &regions,
+        const std::vector<int> &samples, CoverageStatArray &stats) {
+    const int nSamples = samples.size();
+    for (int i = 0; i < nSamples; ++i) {
+        if (0 > samples[i] || (int)hdfs.size() <= samples[i]) {
+            std::cerr << ERROR_STRING << "invalid sample index ("
+                      << samples[i] << ")." << ENDL;
+            return false;
+        }
+    }
+    stats.resize(regions.size() * nSamples);
+
+    // visit the regions by position on each chromosome
+    order.resize(regions.size());
+    for (size_t r = 0; r < regions.size(); ++r)
+        order[r] = r;
+    std::sort(order.begin(), order.end(), RegionLess(regions));
+
+    std::string missingChrom = "";
+    for (size_t k = 0; k < order.size(); ++k) {
+        const CoverageRegion &region = regions[order[k]];
+        const bool isNewChrom
+                = (0 == k || region.seqid != regions[order[k - 1]].seqid);
+        if (isNewChrom && 0 < k)
+            flush_stats(regions[order[k - 1]].seqid);
+        if (isNewChrom && NULL != this->stats)
+            queryTimer.start();
+        const int szRegion = region.end - region.start + 1;
+        for (int i = 0; i < nSamples; ++i) {
+            CoverageStat &stat = stats[(size_t)order[k] * nSamples + i];
+            stat.totalDepth = 0;
+            stat.coveredBases = 0;
+            stat.length = szRegion;
+            stat.isFound = set_chromosome(samples[i], region.seqid);
+            if (!stat.isFound) {
+                if (region.seqid != missingChrom) {
+                    std::cerr << WARNING_STRING << "seqid (" << region.seqid
+                              << ") does not exist in HDF matrix. Skipped."
+                              << ENDL;
+                    missingChrom = region.seqid;
+                }
+                continue;
+            }
+            if (0 >= szRegion)
+                continue;
+            add_region_sum(samples[i], region.start, szRegion, &stat);
+        }
+    }
+    if (!order.empty())
+        flush_stats(regions[order.back()].seqid);
+    return true;
+}
+//------------------------------------------------------------------------------
+bool CoverageQuery::query(
+        const CoverageRegionArray &regions, CoverageStatArray &stats) {
+    allSamples.resize(hdfs.size());
+    for (size_t i = 0; i < hdfs.size(); ++i)
+        allSamples[i] = i;
+    return query(regions, allSamples, stats);
+}
+//------------------------------------------------------------------------------
+CoverageQuery::CoverageQuery() {
+    dataName = EX_COVQ_DATASET;
+    minDepth = EX_COVQ_MIN_DEPTH;
+    inflateThreads = 1;
+    hdfMutex = NULL;
+    stats = NULL;
+}
+//------------------------------------------------------------------------------
+CoverageQuery::~CoverageQuery() {
+    close();
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,135 @@
+#ifndef COVERAGE_QUERY_H
+#define COVERAGE_QUERY_H
+
+#include "histd.h"
+
+#include "hdf_base_depth_reader.h"
+#include "stage_stats.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#define EX_COVQ_MIN_DEPTH 5
+#define EX_COVQ_DATASET "BaseDepth"
+
+//------------------------------------------------------------------------------
+// a region in 1-based, inclusive coordinates as in GFF
+struct CoverageRegion {
+    std::string seqid;
+    int start, end;
+};
+typedef std::vector<CoverageRegion> CoverageRegionArray;
+//------------------------------------------------------------------------------
+// coverage of a region in one matrix; a region that can't be read (e.g. past
+// the end of the chromosome) is left as zero depth
+struct CoverageStat {
+    long totalDepth;
+    int coveredBases, length;
+    bool isFound;  // false when the seqid is not in the matrix
+    float get_avg_depth(void) const {
+        return (float)totalDepth / (float)length;
+    }
+    float get_covered_fraction(void) const {
+        return (float)coveredBases / (float)length;
+    }
+};
+typedef std::vector<CoverageStat> CoverageStatArray;
+//------------------------------------------------------------------------------
+// Batch coverage queries over a set of matrices. Regions are visited in the
+// order of chromosome and position whatever order they are given in, each
+// matrix stays on its chromosome between batches, and the read buffer is
+// kept, so repeated calls do not pay for re-opening or re-allocating.
+//
+//   CoverageQuery query;
+//   query.open(files);
+//   query.query(regions, stats);  // stats[r * files.size() + s]
+//
+// HDF5 is not thread-safe in its default build. Queries used by several
+// threads at once share a mutex given by set_hdf_mutex() before open(), which
+// is held only while the library is called; summing runs in parallel.
+//
+// With set_stats(), the wall and CPU time of each chromosome of a query
+// (waiting for that mutex, reading, inflating and summing its regions) is
+// added to the StageStats as the query stage, with the bytes read and the
+// regions summed. The clocks are read once per chromosome, not per region.
+//
+// Once the buffers have grown and the datasets are open, a query inflating on
+// one thread makes no operator new call of its own (checked by make check).
+// HDF5 still calls malloc() within its reads, and the threads given by
+// set_inflate_threads() are started with their parameters on every read.
+class CoverageQuery {
+public:
+    bool open(const hi::StringArray &matrixFiles);
+    void close(void);
+    void set_min_depth(const int depth) { minDepth = depth; }
+    int get_min_depth(void) const { return minDepth; }
+    void set_dataset(const std::string &name);
+    void set_hdf_mutex(pthread_mutex_t *mutex) { hdfMutex = mutex; }
+    void set_stats(StageStats *stats, const std::string &threadName) {
+        this->stats = stats;
+        this->threadName = threadName;
+    }
+    // threads inflating the chunks of a long region (see RawChunkSet)
+    void set_inflate_threads(const int numThreads) {
+        inflateThreads = (0 < numThreads) ? numThreads : 1;
+    }
+    int get_num_samples(void) const { return hdfs.size(); }
+    // stats[r * samples.size() + i] is regions[r] in the matrix samples[i]
+    bool query(const CoverageRegionArray &regions,
+            const std::vector<int> &samples, CoverageStatArray &stats);
+    // all matrices in the order of open()
+    bool query(const CoverageRegionArray &regions, CoverageStatArray &stats);
+    CoverageQuery();
+    ~CoverageQuery();
+
+protected:
+    bool set_chromosome(const int sample, const std::string &seqid);
+    bool add_region_sum(const int sample, const int start, const int szRegion,
+            CoverageStat *stat);
+    void flush_stats(const std::string &seqid);
+    void lock_hdf(void) {
+        if (NULL != hdfMutex)
+            pthread_mutex_lock(hdfMutex);
+    }
+    void unlock_hdf(void) {
+        if (NULL != hdfMutex)
+            pthread_mutex_unlock(hdfMutex);
+    }
+
+    std::vector<HdfBaseDepthReader *> hdfs;
+    hi::StringArray currentChrom;  // chromosome of each matrix
+    std::string dataName;
+    int minDepth;
+    std::vector<IntType> buffer;
+    std::vector<int> order;
+    std::vector<int> allSamples;  // 0, 1, ... for query() of all matrices
+    std::vector<int> runStart;
+    std::vector<IntType> runValue;
+    RawChunkSet rawChunks;
+    int inflateThreads;
+    pthread_mutex_t *hdfMutex;
+    StageStats *stats;
+    std::string threadName;
+    StageTimer queryTimer;  // of the current chromosome
+    StageCounter queryCounter;
+};
+//------------------------------------------------------------------------------
+// read buffers of get_cover_sum(); keep one per thread and reuse it
+struct CoverBuffer {
+    std::vector<IntType> matrix;
+    std::vector<int> runStart;
+    std::vector<IntType> runValue;
+};
+bool get_cover_sum(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        long *totalDepth, CoverBuffer &buffer);
+// these two use a CoverBuffer of the calling thread
+bool get_cover_sum(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        long *totalDepth);
+bool get_cover_stat(HdfBaseDepthReader &hdf, const int *start,
+        const int *szRegion, int *coveredBases, const int minDepth,
+        float *avgDepth);
+//------------------------------------------------------------------------------
+#endif
@@ -1,224 +1,578 @@
 #include "histd.h"
 
+#include "alignment_filter.h"
+#include "count_buffer_pool.h"
+#include "count_matrix.h"
+#include "gfflib.h"
+#include "hdf_base_depth_reader.h"
+#include "stage_stats.h"
+
 #include <H5Cpp.h>
 #include <algorithm>
 #include <api/BamReader.h>
 #include <api/BamWriter.h>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <getopt.h>
 #include <iostream>
 #include <malloc.h>
 #include <sstream>
 #include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define MAX_NAME_SIZE 255
 #define NUM_THREADS 8
-#define CHUNK_SIZE 65536
 
-typedef int32_t IntMatrixType;
-//------------------------------------------------------------------------------
-struct ThreadCountParam {
-    std::string input_fn, ref_name;
-    int ref_start, ref_end, ref_length, unique_read_count;
-    IntMatrixType *matrix, *clipend_matrix;
-};
-//------------------------------------------------------------------------------
-void *thread_make_matrix(void *arg) {
-    ThreadCountParam *p = (ThreadCountParam *)arg;
-
-    // open the input bam & index files
-    BamTools::BamReader bam_reader;
-    if (!bam_reader.Open(p->input_fn)) {
-        std::cerr << ERROR_STRING << "bam_reader.Open() failed at line "
-                  << __LINE__ << ". input_fn=" << p->input_fn << ENDL;
-        return NULL;
-    }
-    if (!bam_reader.LocateIndex(BamTools::BamIndex::STANDARD))
-        bam_reader.CreateIndex();
+// long-only options
+#define OPTION_STATS 256
+#define OPTION_PROGRESS 257
 
-    // set target region
-    int refid = bam_reader.GetReferenceID(p->ref_name);
-    bam_reader.SetRegion(refid, p->ref_start, refid, p->ref_end);
+// per-chromosome part files of the split output
+#define PARTS_DIR_SUFFIX ".parts"
 
-    // iterate through all alignments
-    int alignment_start, alignment_end, endpos;
-    BamTools::BamAlignment alignment;
-
-    while (bam_reader.GetNextAlignmentCore(alignment)) {
-        if (!alignment.IsMapped())
+//------------------------------------------------------------------------------
+// pick the references to count; complete groups are kept as they are, and in
+// the resume mode incomplete groups are removed to be counted again
+bool select_references(H5::H5File *file, const BamTools::RefVector &refvector,
+        const int output_mode, const bool is_legacy,
+        BamTools::RefVector &targets) {
+    const hid_t fid = file->getId();
+    int num_skipped = 0;
+    for (BamTools::RefVector::const_iterator ref = refvector.begin();
+            ref != refvector.end(); ++ref) {
+        const char *name = ref->RefName.c_str();
+        if (OUTPUT_MODE_CREATE == output_mode
+                || 0 >= H5Lexists(fid, name, H5P_DEFAULT)) {
+            targets.push_back(*ref);
             continue;
-        endpos = alignment.GetEndPosition();
-        alignment_start = std::max(0, std::min(alignment.Position, endpos) - 1);
-        alignment_end
-                = std::min(p->ref_length, std::max(alignment.Position, endpos));
-        for (int i = alignment_start; i < alignment_end; ++i)
-            ++(p->matrix[i]);
+        }
 
-        // soft-clipped read ends
-        if ('S' == alignment.CigarData.at(0).Type
-                && p->ref_length > alignment.Position && 0 <= endpos)
-            p->clipend_matrix[alignment.Position]
-                    += alignment.CigarData.at(0).Length;
-        if ('S' == alignment.CigarData.at(alignment.CigarData.size() - 1).Type
-                && p->ref_length > endpos && 0 <= endpos)
-            p->clipend_matrix[endpos]
-                    += alignment.CigarData.at(alignment.CigarData.size() - 1)
-                               .Length;
+        const bool is_complete = is_legacy
+                || 0 < H5Aexists_by_name(
+                           fid, name, COMPLETE_ATTR_NAME, H5P_DEFAULT);
+        if (!is_complete && OUTPUT_MODE_RESUME == output_mode) {
+            std::cerr << INFO_STRING << "'" << ref->RefName
+                      << "' is incomplete and will be counted again." << ENDL;
+            if (0 > H5Ldelete(fid, name, H5P_DEFAULT)) {
+                std::cerr << ERROR_STRING << "failed to remove the incomplete "
+                          << "group '" << ref->RefName << "'." << ENDL;
+                return false;
+            }
+            targets.push_back(*ref);
+            continue;
+        }
+        if (!is_complete) {
+            std::cerr << WARNING_STRING << "'" << ref->RefName
+                      << "' is incomplete but kept as is. Use -R to count it "
+                         "again."
+                      << ENDL;
+        }
 
-        // count unique reads
-        if (alignment.IsPrimaryAlignment())
-            ++(p->unique_read_count);
+        // the existing group must describe the same reference
+        int length = -1;
+        std::stringstream fstr;
+        fstr << "/" << ref->RefName << "/Length";
+        try {
+            H5::DataSet dataset = file->openDataSet(fstr.str().c_str());
+            dataset.read(&length, H5::PredType::NATIVE_INT);
+        } catch (H5::Exception err) {
+            length = -1;
+        }
+        if (is_complete && length != ref->RefLength) {
+            std::cerr << ERROR_STRING << "'" << ref->RefName << "' in the "
+                      << "matrix has a different length (" << length
+                      << ") from the BAM (" << ref->RefLength << ")." << ENDL;
+            return false;
+        }
+        ++num_skipped;
     }
-
-    bam_reader.Close();
-    return NULL;
+    if (OUTPUT_MODE_CREATE != output_mode) {
+        std::cerr << INFO_STRING << num_skipped
+                  << " reference(s) already in the matrix, " << targets.size()
+                  << " reference(s) to count." << ENDL;
+    }
+    return true;
 }
 //------------------------------------------------------------------------------
-BamTools::RefVector get_refvector(const std::string &input_fn) {
-    // open the input bam & index files
-    BamTools::BamReader bam_reader;
-    if (!bam_reader.Open(input_fn)) {
-        std::cerr << ERROR_STRING << "bam_reader.Open() failed at line "
-                  << __LINE__ << ". input_fn=" << input_fn << ENDL;
-        BamTools::RefVector dummy;
-        return dummy;
+std::string get_part_fn(const std::string &output_fn, const int ref_index) {
+    std::stringstream fstr;
+    fstr << output_fn << PARTS_DIR_SUFFIX << "/" << ref_index << ".h5";
+    return fstr.str();
+}
+//------------------------------------------------------------------------------
+// path of a part file relative to the directory of the assembled matrix
+std::string get_relative_part_fn(
+        const std::string &output_fn, const int ref_index) {
+    const size_t slash = output_fn.find_last_of('/');
+    if (std::string::npos == slash)
+        return get_part_fn(output_fn, ref_index);
+    return get_part_fn(output_fn.substr(slash + 1), ref_index);
+}
+//------------------------------------------------------------------------------
+bool is_part_complete(const std::string &part_fn, const std::string &ref_name) {
+    if (0 != access(part_fn.c_str(), F_OK))
+        return false;
+    const hid_t fid = H5Fopen(part_fn.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (0 > fid)
+        return false;
+    const bool is_complete = 0 < H5Lexists(fid, ref_name.c_str(), H5P_DEFAULT)
+            && 0 < H5Aexists_by_name(fid, ref_name.c_str(), COMPLETE_ATTR_NAME,
+                       H5P_DEFAULT);
+    H5Fclose(fid);
+    return is_complete;
+}
+//------------------------------------------------------------------------------
+// In the split output mode the complete part files are kept unless a new
+// matrix is requested
+void select_part_references(const std::string &output_fn,
+        const BamTools::RefVector &refvector, const int output_mode,
+        BamTools::RefVector &targets, std::vector<int> &target_index) {
+    int num_skipped = 0;
+    for (size_t i = 0; i < refvector.size(); ++i) {
+        if (OUTPUT_MODE_CREATE != output_mode
+                && is_part_complete(
+                        get_part_fn(output_fn, i), refvector[i].RefName)) {
+            ++num_skipped;
+            continue;
+        }
+        targets.push_back(refvector[i]);
+        target_index.push_back(i);
     }
-    if (!bam_reader.LocateIndex(BamTools::BamIndex::STANDARD))
-        bam_reader.CreateIndex();
-
-    BamTools::RefVector refvector = bam_reader.GetReferenceData();
-    bam_reader.Close();
-
-    return refvector;
+    if (OUTPUT_MODE_CREATE != output_mode) {
+        std::cerr << INFO_STRING << num_skipped
+                  << " part file(s) already complete, " << targets.size()
+                  << " reference(s) to count." << ENDL;
+    }
+    return;
 }
 //------------------------------------------------------------------------------
-void write_hdf(H5::H5File *file, const char *ref_name,
-        const IntMatrixType *matrix, const IntMatrixType *clipend_matrix,
-        const int *szMatrix, const int *unique_read_count) {
-    int rank = 1;
-    hsize_t dims[2], cdims[2];
-    H5::Group *group;
-    H5::DataSet *dataset;
-
-    // group for depth matrix
-    std::stringstream fstr;
-    fstr << "/" << ref_name;
+// Write one chromosome to its own part file in a child process. The child
+// gets a copy of the counts and its own HDF5 library state, so the parts are
+// compressed and written in parallel without the library-wide lock.
+// Only the calling thread is copied into the child, so a lock held by any
+// other thread at fork() (libc, iostream or HDF5) would never be released
+// there. The process must therefore be single-threaded here: flush_batch()
+// joins the counting threads first, and --progress, whose thread prints at any
+// time, is rejected with -P.
+pid_t fork_part_writer(const std::string &output_fn, ThreadCountParam *p) {
+    const pid_t pid = fork();
+    if (0 != pid)
+        return pid;
+
+    int status = EXIT_FAILURE;
+    const std::string part_fn = get_part_fn(output_fn, p->ref_index);
     try {
         H5::Exception::dontPrint();
-        group = new H5::Group(file->createGroup(fstr.str().c_str()));
-    } catch (H5::GroupIException err) {
-        std::cerr << ERROR_STRING << "group '" << fstr.str() << "' can't open."
-                  << ENDL;
-        return;
+        H5::H5File *file = new H5::H5File(part_fn.c_str(), H5F_ACC_TRUNC);
+        if (write_hdf(file, p->ref_name.c_str(), p->matrix, p->clipend_matrix,
+                    &p->ref_length, &p->unique_read_count, *p->filters,
+                    p->track_matrix, p->fragment_matrix, p->is_sparse,
+                    p->regions, &p->depth_stat))
+            status = EXIT_SUCCESS;
+        delete file;
+    } catch (H5::Exception err) {
+        std::cerr << ERROR_STRING << "The part file (" << part_fn
+                  << ") can't open for writing." << ENDL;
     }
-
-    // write name
-    fstr << "/FullName";
-    dims[0] = std::strlen(ref_name);
-    H5::DataSpace dataspace(rank, dims);
-    try {
-        H5::Exception::dontPrint();
-        dataset = new H5::DataSet(file->createDataSet(
-                fstr.str().c_str(), H5::PredType::C_S1, dataspace));
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
-                  << "' can't open. func_name='" << err.getFuncName()
-                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
-        return;
+    _exit(status);
+}
+//------------------------------------------------------------------------------
+bool wait_part_writers(std::vector<pid_t> &writers) {
+    bool is_success = true;
+    for (std::vector<pid_t>::const_iterator pid = writers.begin();
+            pid != writers.end(); ++pid) {
+        int status;
+        if (0 > waitpid(*pid, &status, 0) || !WIFEXITED(status)
+                || EXIT_SUCCESS != WEXITSTATUS(status))
+            is_success = false;
     }
-    dataset->write(ref_name, H5::PredType::C_S1, dataspace);
-    delete dataset;
-
-    // write length
-    fstr.str("/");
-    fstr << ref_name << "/Length";
-    dims[0] = 1;
-    H5::DataSpace dataspace2(rank, dims);
-    try {
-        H5::Exception::dontPrint();
-        dataset = new H5::DataSet(file->createDataSet(
-                fstr.str().c_str(), H5::PredType::STD_I32LE, dataspace2));
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
-                  << "' can't open. func_name='" << err.getFuncName()
-                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
-        return;
+    writers.clear();
+    if (!is_success) {
+        std::cerr << ERROR_STRING << "failed to write part file(s)." << ENDL;
     }
-    dataset->write(szMatrix, H5::PredType::STD_I32LE, dataspace2);
-    delete dataset;
-
-    // unique read count -- Added in the matrix Version 0.2
-    fstr.str("/");
-    fstr << ref_name << "/UniqueReadCount";
-    try {
-        H5::Exception::dontPrint();
-        dataset = new H5::DataSet(file->createDataSet(
-                fstr.str().c_str(), H5::PredType::STD_I32LE, dataspace2));
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
-                  << "' can't open. func_name='" << err.getFuncName()
-                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
-        return;
+    return is_success;
+}
+//------------------------------------------------------------------------------
+// join the counting threads of a batch and write their results, either into
+// the matrix or, when file is NULL, into part files by child processes.
+// References whose count buffers were not available or whose counting failed
+// are left out, so that they get no Complete attribute and -R counts them.
+bool flush_batch(H5::H5File *file, const std::string &output_fn,
+        pthread_t *thid, ThreadCountParam *param, const int th_count,
+        std::vector<pid_t> &writers, std::vector<IntMatrixType *> &pending) {
+    bool is_success = true;
+    for (int i = 0; i < th_count; ++i) {
+        pthread_join(thid[i], NULL);
+        if (!param[i].is_allocated) {
+            std::cerr << ERROR_STRING << "count buffers are not available for '"
+                      << param[i].ref_name << "'." << ENDL;
+            is_success = false;
+        } else if (param[i].is_failed) {
+            std::cerr << ERROR_STRING << "failed to count '"
+                      << param[i].ref_name << "'. It is not written." << ENDL;
+            is_success = false;
+        }
     }
-    dataset->write(unique_read_count, H5::PredType::STD_I32LE, dataspace2);
-    delete dataset;
 
-    // base depth
-    fstr.str("/");
-    fstr << ref_name << "/BaseDepth";
-    dims[0] = *szMatrix;
-    cdims[0] = std::min(CHUNK_SIZE, *szMatrix);
-    H5::DataSpace dataspace3(rank, dims);
-
-    H5::DSetCreatPropList ds_creatplist;
-    ds_creatplist.setChunk(rank, cdims);
-    ds_creatplist.setDeflate(5);
-
-    try {
-        H5::Exception::dontPrint();
-        dataset = new H5::DataSet(file->createDataSet(fstr.str().c_str(),
-                H5::PredType::STD_I32LE, dataspace3, ds_creatplist));
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
-                  << "' can't open. func_name='" << err.getFuncName()
-                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
-        return;
+    if (NULL != file) {
+        std::vector<IntMatrixType *> buffers;
+        for (int i = 0; i < th_count; ++i) {
+            if (!param[i].is_allocated)
+                continue;
+            if (param[i].is_failed) {
+                get_count_matrices(&param[i], buffers);
+                continue;
+            }
+            StageTimer timer;
+            StageCounter write;
+            if (NULL != param[i].stats)
+                timer.start();
+            if (!write_hdf(file, param[i].ref_name.c_str(), param[i].matrix,
+                        param[i].clipend_matrix, &param[i].ref_length,
+                        &param[i].unique_read_count, *param[i].filters,
+                        param[i].track_matrix, param[i].fragment_matrix,
+                        param[i].is_sparse, param[i].regions,
+                        &param[i].depth_stat))
+                is_success = false;
+            get_count_matrices(&param[i], buffers);
+            if (NULL != param[i].stats) {
+                // bytes of the tracks before compression
+                const long num_tracks = 2 + param[i].filters->size()
+                        + ((NULL != param[i].fragment_matrix) ? 1 : 0);
+                timer.stop(&write,
+                        num_tracks * param[i].matrix_length
+                                * (long)sizeof(IntMatrixType),
+                        param[i].matrix_length);
+                param[i].stats->add(
+                        "hdf_write", "main", param[i].ref_name, write);
+            }
+        }
+        release_count_matrices(param[0].pool, buffers);
+        return is_success;
     }
-    dataset->write(matrix, H5::PredType::STD_I32LE, dataspace3);
-    delete dataset;
 
-    // clip-end counts at the detected positions
-    fstr.str("/");
-    fstr << ref_name << "/ClipEndCount";
+    // At most one batch of writers is in flight while the next one is
+    // counted. Their buffers go back to the pool only after they exit, as
+    // writing to pages shared with a child would copy them on every fault.
+    if (!wait_part_writers(writers))
+        is_success = false;
+    release_count_matrices(param[0].pool, pending);
+    std::vector<IntMatrixType *> failed;
+    for (int i = 0; i < th_count; ++i) {
+        if (!param[i].is_allocated)
+            continue;
+        if (param[i].is_failed) {
+            get_count_matrices(&param[i], failed);
+            continue;
+        }
+        const pid_t pid = fork_part_writer(output_fn, &param[i]);
+        if (0 > pid) {
+            std::cerr << ERROR_STRING << "fork() failed for '"
+                      << param[i].ref_name << "'." << ENDL;
+            is_success = false;
+        } else {
+            writers.push_back(pid);
+        }
+        get_count_matrices(&param[i], pending);
+    }
+    release_count_matrices(param[0].pool, failed);
+    return is_success;
+}
+//------------------------------------------------------------------------------
+std::string escape_vds_name(const std::string &name) {
+    std::string escaped;
+    for (size_t i = 0; i < name.length(); ++i) {
+        if ('%' == name[i])
+            escaped += '%';
+        escaped += name[i];
+    }
+    return escaped;
+}
+//------------------------------------------------------------------------------
+// Link one chromosome of a part file into the assembled matrix. Chunked
+// arrays become virtual datasets mapping the whole extent of the part, and
+// everything else (names, lengths, read counts) is copied.
+bool add_virtual_group(const hid_t top_id, const std::string &part_fn,
+        const std::string &relative_fn, const std::string &ref_name) {
+    const hid_t part_id = H5Fopen(part_fn.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (0 > part_id) {
+        std::cerr << ERROR_STRING << "The part file (" << part_fn
+                  << ") can't open." << ENDL;
+        return false;
+    }
+    const hid_t src_group
+            = H5Gopen2(part_id, ref_name.c_str(), H5P_DEFAULT);
+    const hid_t dst_group = H5Gcreate2(top_id, ref_name.c_str(), H5P_DEFAULT,
+            H5P_DEFAULT, H5P_DEFAULT);
+    if (0 > src_group || 0 > dst_group) {
+        std::cerr << ERROR_STRING << "group '" << ref_name
+                  << "' can't open in " << part_fn << "." << ENDL;
+        H5Fclose(part_id);
+        return false;
+    }
 
-    try {
-        H5::Exception::dontPrint();
-        dataset = new H5::DataSet(file->createDataSet(fstr.str().c_str(),
-                H5::PredType::STD_I32LE, dataspace3, ds_creatplist));
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "dataset '" << fstr.str()
-                  << "' can't open. func_name='" << err.getFuncName()
-                  << "', msg='" << err.getDetailMsg() << "'." << ENDL;
-        return;
+    hi::StringArray names;
+    H5Literate(src_group, H5_INDEX_NAME, H5_ITER_INC, NULL, add_group,
+            (void *)&names);
+
+    bool is_success = true;
+    for (hi::StringArray::const_iterator name = names.begin();
+            name != names.end() && is_success; ++name) {
+        const hid_t object = H5Oopen(src_group, name->c_str(), H5P_DEFAULT);
+        hid_t src_dataset = -1, dcpl = -1;
+        if (H5I_DATASET == H5Iget_type(object)) {
+            src_dataset = H5Dopen2(src_group, name->c_str(), H5P_DEFAULT);
+            dcpl = H5Dget_create_plist(src_dataset);
+        }
+        H5Oclose(object);
+        if (0 > dcpl || H5D_CHUNKED != H5Pget_layout(dcpl)) {
+            is_success = 0 <= H5Ocopy(src_group, name->c_str(), dst_group,
+                                      name->c_str(), H5P_DEFAULT, H5P_DEFAULT);
+        } else {
+            const hid_t space = H5Dget_space(src_dataset);
+            const hid_t type = H5Dget_type(src_dataset);
+            const hid_t vdcpl = H5Pcreate(H5P_DATASET_CREATE);
+            const std::string src_name = "/" + ref_name + "/" + *name;
+            H5Sselect_all(space);
+            H5Pset_virtual(vdcpl, space, escape_vds_name(relative_fn).c_str(),
+                    escape_vds_name(src_name).c_str(), space);
+            const hid_t vds = H5Dcreate2(dst_group, name->c_str(), type, space,
+                    H5P_DEFAULT, vdcpl, H5P_DEFAULT);
+            is_success = 0 <= vds;
+            H5Dclose(vds);
+            H5Pclose(vdcpl);
+            H5Tclose(type);
+            H5Sclose(space);
+        }
+        if (0 <= dcpl)
+            H5Pclose(dcpl);
+        if (0 <= src_dataset)
+            H5Dclose(src_dataset);
+        if (!is_success) {
+            std::cerr << ERROR_STRING << "failed to link '" << ref_name << "/"
+                      << *name << "' from " << part_fn << "." << ENDL;
+        }
+    }
+    H5Gclose(dst_group);
+    H5Gclose(src_group);
+    H5Fclose(part_id);
+    return is_success;
+}
+//------------------------------------------------------------------------------
+bool assemble_virtual_matrix(
+        H5::H5File *file, const std::string &output_fn,
+        const BamTools::RefVector &refvector) {
+    for (size_t i = 0; i < refvector.size(); ++i) {
+        const std::string &ref_name = refvector[i].RefName;
+        if (!add_virtual_group(file->getId(), get_part_fn(output_fn, i),
+                    get_relative_part_fn(output_fn, i), ref_name))
+            return false;
+
+        const int complete = 1;
+        H5::Group group = file->openGroup(ref_name.c_str());
+        H5::DataSpace scalar(H5S_SCALAR);
+        H5::Attribute attr = group.createAttribute(
+                COMPLETE_ATTR_NAME, H5::PredType::STD_I32LE, scalar);
+        attr.write(H5::PredType::STD_I32LE, &complete);
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// a BED coordinate: a non-negative decimal that fits in an int
+bool parse_bed_position(const std::string &value, int *position) {
+    if (value.empty())
+        return false;
+    char *end = NULL;
+    errno = 0;
+    const long number = std::strtol(value.c_str(), &end, 10);
+    if ('\0' != *end || 0 != errno || 0 > number || INT_MAX < number)
+        return false;
+    *position = number;
+    return true;
+}
+//------------------------------------------------------------------------------
+// Read target intervals from a BED (0-based, half-open) or GFF (1-based,
+// inclusive) file, chosen by the '.bed' suffix. gff_coverage reads a 1-based
+// feature [start, end] as matrix indices, so both formats are stored as the
+// same widened index range: GFF [start - 1, end + 1) and BED [start, end + 1),
+// and a GFF feature covering exactly a BED target reads the same bases.
+bool read_target_regions(const std::string &regions_fn,
+        const BamTools::RefVector &refvector, TargetRegionsDB &db) {
+    typedef std::map<std::string, std::vector<std::pair<int, int> > >
+            IntervalDB;
+    IntervalDB intervals;
+    const std::string suffix = ".bed";
+    if (suffix.length() < regions_fn.length()
+            && suffix
+                    == regions_fn.substr(
+                            regions_fn.length() - suffix.length())) {
+        std::ifstream infile(regions_fn.c_str(), std::ios::in);
+        if (infile.fail()) {
+            std::cerr << ERROR_STRING << "failed to open the target regions ("
+                      << regions_fn << ")." << ENDL;
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0, start = 0, end = 0;
+        while (std::getline(infile, line)) {
+            ++lineNumber;
+            if (line.empty() || '#' == line[0] || 0 == line.find("track")
+                    || 0 == line.find("browser"))
+                continue;
+            hi::StringArray items;
+            hi::split(items, line, '\t');
+            if (3 > items.size() || !parse_bed_position(items[1], &start)
+                    || !parse_bed_position(items[2], &end) || end <= start
+                    || INT_MAX == end) {
+                std::cerr << ERROR_STRING << "invalid BED record at line "
+                          << lineNumber << " of " << regions_fn
+                          << ". line=" << line << ENDL;
+                return false;
+            }
+            intervals[items[0]].push_back(std::pair<int, int>(start, end + 1));
+        }
+        infile.close();
+    } else {
+        GffRecordArray records;
+        if (!read_gff_from_file(regions_fn.c_str(), records))
+            return false;
+        for (GffRecordArray::const_iterator record = records.begin();
+                record != records.end(); ++record) {
+            intervals[record->seqid].push_back(std::pair<int, int>(
+                    record->start - 1, record->end + 1));
+        }
     }
-    dataset->write(clipend_matrix, H5::PredType::STD_I32LE, dataspace3);
-    delete dataset;
 
-    delete group;
+    // sort and merge the intervals of each reference in the BAM
+    for (BamTools::RefVector::const_iterator ref = refvector.begin();
+            ref != refvector.end(); ++ref) {
+        IntervalDB::iterator hit = intervals.find(ref->RefName);
+        if (intervals.end() == hit)
+            continue;
+        std::vector<std::pair<int, int> > &list = hit->second;
+        std::sort(list.begin(), list.end());
+        TargetRegions regions;
+        regions.length = 0;
+        for (size_t i = 0; i < list.size(); ++i) {
+            const int start = std::max(0, list[i].first);
+            const int end = std::min(ref->RefLength, list[i].second);
+            if (start >= end)
+                continue;
+            if (!regions.end.empty() && start <= regions.end.back()) {
+                if (end > regions.end.back()) {
+                    regions.length += end - regions.end.back();
+                    regions.end.back() = end;
+                }
+                continue;
+            }
+            regions.start.push_back(start);
+            regions.end.push_back(end);
+            regions.offset.push_back(regions.length);
+            regions.length += end - start;
+        }
+        if (!regions.start.empty())
+            db[ref->RefName] = regions;
+        intervals.erase(hit);
+    }
+    for (IntervalDB::const_iterator rest = intervals.begin();
+            rest != intervals.end(); ++rest) {
+        std::cerr << WARNING_STRING << "seqid (" << rest->first
+                  << ") of the target regions does not exist in the BAM. "
+                     "Skipped."
+                  << ENDL;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// A filter name becomes the dataset name 'BaseDepth.name', so it must be
+// unique and must not contain a group separator or whitespace.
+bool is_valid_filter_name(
+        const AlignmentFilterArray &filters, const std::string &name) {
+    if (std::string::npos != name.find_first_of("/ \t\r\n")) {
+        std::cerr << ERROR_STRING << "filter name '" << name
+                  << "' must not contain '/' or whitespace." << ENDL;
+        return false;
+    }
+    for (size_t t = 0; t < filters.size(); ++t) {
+        if (name == filters[t].name) {
+            std::cerr << ERROR_STRING << "filter name '" << name
+                      << "' is given more than once." << ENDL;
+            return false;
+        }
+    }
+    return true;
 }
 //------------------------------------------------------------------------------
 inline void print_usage(const char *cmd) {
     std::cerr << USAGE_STRING << cmd
-              << " (-t num_threads=8) -i [bam_fn] -o [matrix_fn]" << ENDL;
+              << " (-t num_threads=8) (-f name:filter ...) (-F) (-R|-A) (-P) "
+                 "(-H) (-S) (-r regions) (-v) (--stats file.json) "
+                 "(--progress[=sec]) -i [bam_fn] -o [matrix_fn]"
+              << ENDL;
+    std::cerr << " -f  add a filtered depth track 'BaseDepth.name' counted in "
+                 "the same pass (repeatable)."
+              << ENDL
+              << "     filter: comma-separated mapq=N, strand=+|-, nodup, "
+                 "nosec, nosupp, noqcfail, proper, f=INT, F=INT"
+              << ENDL
+              << "     e.g. -f q20:mapq=20,nodup,nosec -f fwd:strand=+" << ENDL;
+    std::cerr << " -F  add 'FragmentDepth' of properly paired primary "
+                 "alignments, counting each template once."
+              << ENDL;
+    std::cerr << " -R  resume: keep the complete chromosomes of an existing "
+                 "matrix and count the missing or incomplete ones"
+              << ENDL;
+    std::cerr << " -A  append: add the references missing from an existing "
+                 "matrix without rewriting existing ones"
+              << ENDL;
+    std::cerr << " -P  write each chromosome to its own file under "
+                 "matrix_fn" PARTS_DIR_SUFFIX "/ in parallel and assemble "
+                 "matrix_fn from virtual datasets"
+              << ENDL
+              << "     (the part directory must be kept next to matrix_fn; "
+                 "-R and -A reuse complete part files; not with --progress)"
+              << ENDL;
+    std::cerr << " -H  back count buffers with transparent huge pages" << ENDL;
+    std::cerr << " -S  store mostly-zero or low-coverage tracks sparsely "
+                 "(coordinate/value or run-length) when much smaller"
+              << ENDL;
+    std::cerr << " -r  count and store only the target intervals of a BED "
+                 "(.bed) or GFF file"
+              << ENDL
+              << "     (references without targets are left out; "
+                 "FragmentDepth counts templates whose leftmost mate "
+                 "overlaps a target)"
+              << ENDL;
+    std::cerr << " -v  report count buffer and page-fault counters" << ENDL;
+    std::cerr << " --stats file.json  write wall/CPU time, bytes and records "
+                 "per stage, thread and chromosome"
+              << ENDL;
+    std::cerr << " --progress[=sec]   print the progress to stderr "
+                 "periodically [" << EX_STATS_PROGRESS_INTERVAL << "]"
+              << ENDL;
 }
 //------------------------------------------------------------------------------
 int main(int argc, char **argv) {
     // parse arguments
-    char option;
-    std::string input_fn = "", output_fn = "";
+    int option;
+    std::string input_fn = "", output_fn = "", regions_fn = "", stats_fn = "";
     int num_threads = NUM_THREADS;
-    while ((option = getopt(argc, argv, "i:o:t:")) != -1) {
+    AlignmentFilterArray filters;
+    bool is_fragment_depth = false;
+    int output_mode = OUTPUT_MODE_CREATE;
+    bool is_split_output = false, is_huge_pages = false, is_verbose = false;
+    bool is_sparse = false, is_progress = false;
+    double progress_interval = EX_STATS_PROGRESS_INTERVAL;
+    static struct option long_options[] = {
+            {"stats", required_argument, NULL, OPTION_STATS},
+            {"progress", optional_argument, NULL, OPTION_PROGRESS},
+            {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "i:o:t:f:FRAPHSr:v",
+                    long_options, NULL))
+            != -1) {
         switch (option) {
             case 'i':
                 input_fn = optarg;
@@ -229,6 +583,45 @@ int main(int argc, char **argv) {
             case 't':
                 num_threads = std::atoi(optarg);
                 break;
+            case 'f': {
+                AlignmentFilter filter;
+                if (!filter.parse(optarg)
+                        || !is_valid_filter_name(filters, filter.name))
+                    exit(EXIT_FAILURE);
+                filters.push_back(filter);
+            } break;
+            case 'F':
+                is_fragment_depth = true;
+                break;
+            case 'R':
+                output_mode = OUTPUT_MODE_RESUME;
+                break;
+            case 'A':
+                output_mode = OUTPUT_MODE_APPEND;
+                break;
+            case 'P':
+                is_split_output = true;
+                break;
+            case 'H':
+                is_huge_pages = true;
+                break;
+            case 'S':
+                is_sparse = true;
+                break;
+            case 'r':
+                regions_fn = optarg;
+                break;
+            case 'v':
+                is_verbose = true;
+                break;
+            case OPTION_STATS:
+                stats_fn = optarg;
+                break;
+            case OPTION_PROGRESS:
+                is_progress = true;
+                if (NULL != optarg)
+                    progress_interval = std::atof(optarg);
+                break;
             default:
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
@@ -239,6 +632,12 @@ int main(int argc, char **argv) {
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+    // the part writers are forked while the progress thread may hold a lock
+    if (is_split_output && is_progress) {
+        std::cerr << ERROR_STRING << "--progress can't be used with -P."
+                  << ENDL;
+        exit(EXIT_FAILURE);
+    }
 
     // get RefVector to know about the ref sequences
     BamTools::RefVector refvector = get_refvector(input_fn);
@@ -248,48 +647,123 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    // restrict the matrix to the target intervals
+    TargetRegionsDB target_regions;
+    if (!regions_fn.empty()) {
+        if (!read_target_regions(regions_fn, refvector, target_regions))
+            exit(EXIT_FAILURE);
+        BamTools::RefVector restricted;
+        long num_bases = 0, num_regions = 0;
+        for (BamTools::RefVector::const_iterator ref = refvector.begin();
+                ref != refvector.end(); ++ref) {
+            TargetRegionsDB::const_iterator hit
+                    = target_regions.find(ref->RefName);
+            if (target_regions.end() == hit)
+                continue;
+            restricted.push_back(*ref);
+            num_regions += hit->second.start.size();
+            num_bases += hit->second.length;
+        }
+        if (restricted.empty()) {
+            std::cerr << ERROR_STRING << "no target region on the references "
+                      << "of " << input_fn << "." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        std::cerr << INFO_STRING << num_regions << " target interval(s), "
+                  << num_bases << " bases on " << restricted.size()
+                  << " reference(s)." << ENDL;
+        refvector = restricted;
+    }
+
     // supress output of error messages
     H5::Exception::dontPrint();
 
-    // output file
-    H5::H5File *file;
-    try {
-        H5::Exception::dontPrint();
-        file = new H5::H5File(output_fn.c_str(), H5F_ACC_TRUNC);
-    } catch (H5::FileIException err) {
-        std::cerr << "The output matrix (" << output_fn
-                  << ") can't open for writing." << ENDL;
-        exit(EXIT_FAILURE);
+    // output file; in the split mode the matrix is assembled at the end
+    bool is_legacy = false;
+    H5::H5File *file = NULL;
+    BamTools::RefVector targets;
+    std::vector<int> target_index;
+    if (is_split_output) {
+        const std::string parts_dir = output_fn + PARTS_DIR_SUFFIX;
+        if (0 != mkdir(parts_dir.c_str(), 0755) && EEXIST != errno) {
+            std::cerr << ERROR_STRING << "can't create a directory for part "
+                      << "files (" << parts_dir << ")." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        select_part_references(
+                output_fn, refvector, output_mode, targets, target_index);
+    } else {
+        file = open_output(output_fn, output_mode, &is_legacy);
+        if (NULL == file) {
+            exit(EXIT_FAILURE);
+        }
+        if (is_legacy) {
+            std::cerr << WARNING_STRING << "the matrix has no completion "
+                      << "marks. All existing chromosomes are regarded as "
+                      << "complete." << ENDL;
+        }
+
+        // references to count
+        if (!select_references(
+                    file, refvector, output_mode, is_legacy, targets)) {
+            delete file;
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < targets.size(); ++i)
+            target_index.push_back(i);
+    }
+
+    // stage counters and progress
+    StageStats *stats = NULL;
+    if (!stats_fn.empty() || is_progress) {
+        stats = new StageStats;
+        if (is_progress) {
+            stats->start_progress(progress_interval, "alignments",
+                    "chromosomes", targets.size());
+        }
     }
 
     // thread args
     pthread_t *thid = new pthread_t[num_threads];
     ThreadCountParam *param = new ThreadCountParam[num_threads];
-    IntMatrixType **read_matrix = new IntMatrixType *[num_threads];
-    IntMatrixType **clipend_matrix = new IntMatrixType *[num_threads];
-
+    const int num_tracks = filters.size();
+    IntMatrixType **track_matrix
+            = new IntMatrixType *[num_threads * num_tracks];
+    CountBufferPool pool;
+    pool.set_huge_pages(is_huge_pages);
+    std::vector<pid_t> writers;
+    std::vector<IntMatrixType *> pending;
+    bool is_success = true;
+
+    // no new reference is started once a batch has failed
     int th_count = 0;
-    for (BamTools::RefVector::const_iterator ref = refvector.begin();
-            ref != refvector.end(); ++ref) {
-        // Counting matrices
-        read_matrix[th_count] = new IntMatrixType[ref->RefLength];
-        clipend_matrix[th_count] = new IntMatrixType[ref->RefLength];
+    for (size_t r = 0; r < targets.size() && is_success; ++r) {
+        const BamTools::RefData *ref = &targets[r];
 
         // Thread params
         param[th_count].input_fn = input_fn;
         param[th_count].ref_name = ref->RefName;
+        param[th_count].ref_index = target_index[r];
         param[th_count].ref_start = 0;
         param[th_count].ref_end = ref->RefLength;
         param[th_count].ref_length = ref->RefLength;
+        TargetRegionsDB::const_iterator hit
+                = target_regions.find(ref->RefName);
+        param[th_count].regions
+                = (target_regions.end() == hit) ? NULL : &hit->second;
+        param[th_count].matrix_length = (target_regions.end() == hit)
+                ? ref->RefLength
+                : hit->second.length;
         param[th_count].unique_read_count = 0;
-        param[th_count].matrix = read_matrix[th_count];
-        param[th_count].clipend_matrix = clipend_matrix[th_count];
-
-#pragma omp parallel for
-        for (int i = 0; i < ref->RefLength; ++i) {
-            read_matrix[th_count][i] = 0;
-            clipend_matrix[th_count][i] = 0;
-        }
+        param[th_count].filters = &filters;
+        param[th_count].track_matrix = &track_matrix[th_count * num_tracks];
+        param[th_count].is_fragment_depth = is_fragment_depth;
+        param[th_count].is_sparse = is_sparse;
+        param[th_count].pool = &pool;
+        param[th_count].stats = stats;
+        std::stringstream thread_name;
+        thread_name << "count" << th_count;
+        param[th_count].thread_name = thread_name.str();
 
         // counting
         pthread_create(
@@ -297,35 +771,46 @@ int main(int argc, char **argv) {
         ++th_count;
 
         if (th_count == num_threads) {
-            for (int i = 0; i < th_count; ++i)
-                pthread_join(thid[i], NULL);
-            for (int i = 0; i < th_count; ++i) {
-                write_hdf(file, param[i].ref_name.c_str(), read_matrix[i],
-                        clipend_matrix[i], &param[i].ref_length,
-                        &param[i].unique_read_count);
-                delete[] read_matrix[i];
-                delete[] clipend_matrix[i];
-            }
+            if (!flush_batch(file, output_fn, thid, param, th_count, writers,
+                        pending))
+                is_success = false;
             th_count = 0;
         }
     }
 
     // purge leftovers
     if (0 < th_count) {
-        for (int i = 0; i < th_count; ++i)
-            pthread_join(thid[i], NULL);
-        for (int i = 0; i < th_count; ++i) {
-            write_hdf(file, param[i].ref_name.c_str(), read_matrix[i],
-                    clipend_matrix[i], &param[i].ref_length,
-                    &param[i].unique_read_count);
-            delete[] read_matrix[i];
-            delete[] clipend_matrix[i];
+        if (!flush_batch(file, output_fn, thid, param, th_count, writers,
+                    pending))
+            is_success = false;
+    }
+
+    // assemble the parts into one matrix of virtual datasets
+    if (is_split_output) {
+        if (!wait_part_writers(writers))
+            is_success = false;
+        release_count_matrices(&pool, pending);
+        if (is_success) {
+            file = open_output(output_fn, OUTPUT_MODE_CREATE, &is_legacy);
+            if (NULL == file
+                    || !assemble_virtual_matrix(file, output_fn, refvector))
+                is_success = false;
         }
     }
 
     delete[] thid;
     delete[] param;
+    delete[] track_matrix;
     delete file;
-    exit(EXIT_SUCCESS);
+    if (is_verbose)
+        pool.print_stats(std::cerr);
+    if (NULL != stats) {
+        stats->stop_progress();
+        if (!stats_fn.empty()
+                && !stats->write_json(stats_fn, "create_read_count_matrix"))
+            is_success = false;
+        delete stats;
+    }
+    exit(is_success ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 //------------------------------------------------------------------------------
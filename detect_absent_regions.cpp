@@ -0,0 +1,426 @@
+#include "histd.h"
+
+#include "hdf_base_depth_reader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define EX_DAR_MAX_DEPTH 0.0f
+#define EX_DAR_MIN_LENGTH 100
+#define EX_DAR_BLOCK_SIZE 1048576
+#define EX_DAR_NUM_THREADS 1
+//------------------------------------------------------------------------------
+struct SampleGroup {
+    std::string name;
+    int begin, end;  // sample range [begin, end) in the sorted sample order
+};
+typedef std::vector<SampleGroup> SampleGroupArray;
+//------------------------------------------------------------------------------
+struct SegmentState {
+    bool isOpen;
+    int start;
+    std::vector<double> sumDepth;  // summed group mean depth, one per group
+};
+//------------------------------------------------------------------------------
+bool read_sample_sheet(const char *sheetFn, hi::StringArray &inputFiles,
+        hi::StringArray &groupNames) {
+    std::ifstream infile(sheetFn, std::ios::in);
+    if (infile.fail()) {
+        std::cerr << ERROR_STRING << "failed to open the sample sheet ("
+                  << sheetFn << "). Aborted. [code: " << __LINE__ << "]"
+                  << ENDL;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+        if (line.empty() || '#' == line[0]) {
+            continue;
+        }
+        hi::StringArray items;
+        hi::split(items, line, '\t', hi::HISTD_SPLITMODE_NOEMPTY);
+        if (2 > items.size()) {
+            std::cerr << ERROR_STRING
+                      << "invalid sample sheet record. line=" << line << ENDL;
+            return false;
+        }
+        inputFiles.push_back(items.at(0));
+        groupNames.push_back(items.at(1));
+    }
+    infile.close();
+    return true;
+}
+//------------------------------------------------------------------------------
+// sort samples so that members of the same group are adjacent; order[i] is
+// the index of the input file placed at the i-th slot
+void make_sample_groups(const hi::StringArray &groupNames,
+        std::vector<int> &order, SampleGroupArray &groups) {
+    for (size_t i = 0; i < groupNames.size(); ++i) {
+        bool isFound = false;
+        for (SampleGroupArray::const_iterator g = groups.begin();
+                g != groups.end(); ++g) {
+            if (g->name == groupNames[i]) {
+                isFound = true;
+                break;
+            }
+        }
+        if (isFound)
+            continue;
+        SampleGroup group;
+        group.name = groupNames[i];
+        group.begin = order.size();
+        for (size_t j = i; j < groupNames.size(); ++j) {
+            if (groupNames[j] == group.name)
+                order.push_back(j);
+        }
+        group.end = order.size();
+        groups.push_back(group);
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+bool open_hdfs(const hi::StringArray &inputFiles, HdfBaseDepthReader *hdfs) {
+    bool isError = false;
+    for (size_t i = 0; i < inputFiles.size(); ++i) {
+        if (!hdfs[i].open(inputFiles[i].c_str())) {
+            std::cerr << WARNING_STRING << "failed to open an input HDF ("
+                      << inputFiles[i] << "). [code: " << __LINE__ << "]"
+                      << ENDL;
+            isError = true;
+        }
+    }
+    return !isError;
+}
+//------------------------------------------------------------------------------
+// scale factors that bring every sample to the mean library size, where the
+// library size is the sum of UniqueReadCount over all chromosomes
+bool get_scale_factors(HdfBaseDepthReader *hdfs, const int nFiles,
+        const hi::StringArray &chromNames, float *factors) {
+    std::vector<double> libSize(nFiles, 0.0);
+    double meanSize = 0.0;
+    for (int i = 0; i < nFiles; ++i) {
+        for (hi::StringArray::const_iterator chr = chromNames.begin();
+                chr != chromNames.end(); ++chr) {
+            int readCount = 0;
+            if (!hdfs[i].get_unique_read_count(chr->c_str(), &readCount)) {
+                std::cerr << ERROR_STRING << "UniqueReadCount is unavailable "
+                          << "for '" << *chr << "' in the matrix #" << i + 1
+                          << ". Use -N to disable normalization." << ENDL;
+                return false;
+            }
+            libSize[i] += readCount;
+        }
+        meanSize += libSize[i] / nFiles;
+    }
+    for (int i = 0; i < nFiles; ++i) {
+        factors[i]
+                = (0.0 < libSize[i]) ? (float)(meanSize / libSize[i]) : 0.0f;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+bool set_chromosome(HdfBaseDepthReader *hdfs, const int nFiles,
+        const char *chromName, int *chromLength) {
+    *chromLength = -1;
+    for (int i = 0; i < nFiles; ++i) {
+        if (!hdfs[i].set_target_chromosome(chromName)
+                || !hdfs[i].set_target_dataset(
+                        "BaseDepth", H5::PredType::STD_I32LE))
+            return false;
+        const int length = hdfs[i].get_num_elements();
+        if (0 <= *chromLength && length != *chromLength) {
+            std::cerr << WARNING_STRING << "chromosome '" << chromName
+                      << "' has different lengths among matrices." << ENDL;
+            return false;
+        }
+        *chromLength = length;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// a low segment is reported when it is long enough and, if requested, at least
+// one other group is covered over the segment. Segments are written as BED
+// intervals [start, end) of 0-based matrix offsets.
+bool close_segment(const SegmentState &segment, const int end,
+        const int groupIndex, const SampleGroupArray &groups,
+        const char *chromName, const int minLength, const float minCoverDepth,
+        std::ostream &ost) {
+    const int length = end - segment.start;
+    const int nGroups = groups.size();
+    if (minLength > length)
+        return false;
+    if (0.0f < minCoverDepth) {
+        bool isCoveredElsewhere = false;
+        for (int h = 0; h < nGroups; ++h) {
+            if (h != groupIndex
+                    && minCoverDepth <= segment.sumDepth[h] / length)
+                isCoveredElsewhere = true;
+        }
+        if (!isCoveredElsewhere)
+            return false;
+    }
+
+    const char sep = '\t';
+    ost << chromName << sep << segment.start << sep << end << sep << length
+        << sep << groups[groupIndex].name;
+    for (int h = 0; h < nGroups; ++h) {
+        ost << sep << (float)(segment.sumDepth[h] / length);
+    }
+    ost << ENDL;
+    return true;
+}
+//------------------------------------------------------------------------------
+bool detect_absent_regions(HdfBaseDepthReader *hdfs,
+        const std::vector<int> &order, const SampleGroupArray &groups,
+        const float *factors, const char *chromName, const int chromLength,
+        const float maxDepth, const float minCoverDepth, const int minLength,
+        const int blockSize, std::ostream &ost) {
+    const int nSamples = order.size();
+    const int nGroups = groups.size();
+
+    // per-sample read buffer and position-major normalized depth so that the
+    // samples of one position are contiguous for the vectorized inner loop
+    IntType *depth = new IntType[blockSize];
+    float *normDepth = new float[(size_t)blockSize * nSamples];
+    float *groupDepth = new float[nGroups];
+    bool *isLow = new bool[nGroups];
+    std::vector<SegmentState> segments(nGroups);
+    for (int g = 0; g < nGroups; ++g) {
+        segments[g].isOpen = false;
+        segments[g].sumDepth.assign(nGroups, 0.0);
+    }
+
+    bool isSuccess = true;
+    for (int blockStart = 0; blockStart < chromLength && isSuccess;
+            blockStart += blockSize) {
+        const int count = std::min(blockSize, chromLength - blockStart);
+        for (int s = 0; s < nSamples; ++s) {
+            if (!hdfs[order[s]].get_matrix(&blockStart, &count, depth)) {
+                isSuccess = false;
+                break;
+            }
+            const float factor = factors[order[s]];
+            float *column = normDepth + s;
+            for (int pos = 0; pos < count; ++pos) {
+                column[(size_t)pos * nSamples] = factor * depth[pos];
+            }
+        }
+        if (!isSuccess)
+            break;
+
+        for (int pos = 0; pos < count; ++pos) {
+            const float *row = normDepth + (size_t)pos * nSamples;
+            for (int g = 0; g < nGroups; ++g) {
+                const int begin = groups[g].begin, end = groups[g].end;
+                int nLow = 0;
+                float sum = 0.0f;
+#pragma omp simd reduction(+ : nLow, sum)
+                for (int s = begin; s < end; ++s) {
+                    nLow += (row[s] <= maxDepth);
+                    sum += row[s];
+                }
+                groupDepth[g] = sum / (end - begin);
+                isLow[g] = (nLow == end - begin);
+            }
+
+            const int chromPos = blockStart + pos;
+            for (int g = 0; g < nGroups; ++g) {
+                SegmentState &segment = segments[g];
+                if (segment.isOpen && !isLow[g]) {
+                    close_segment(segment, chromPos, g, groups, chromName,
+                            minLength, minCoverDepth, ost);
+                    segment.isOpen = false;
+                } else if (!segment.isOpen && isLow[g]) {
+                    segment.isOpen = true;
+                    segment.start = chromPos;
+                    segment.sumDepth.assign(nGroups, 0.0);
+                }
+                if (segment.isOpen) {
+                    for (int h = 0; h < nGroups; ++h)
+                        segment.sumDepth[h] += groupDepth[h];
+                }
+            }
+        }
+    }
+
+    // segments reaching the end of the chromosome
+    for (int g = 0; g < nGroups && isSuccess; ++g) {
+        if (segments[g].isOpen)
+            close_segment(segments[g], chromLength, g, groups, chromName,
+                    minLength, minCoverDepth, ost);
+    }
+
+    delete[] depth;
+    delete[] normDepth;
+    delete[] groupDepth;
+    delete[] isLow;
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+void print_usage(const char *cmd) {
+    std::cerr << USAGE_STRING << cmd << " (options) matrix1 matrix2..." << ENDL;
+    std::cerr << "Available options:" << ENDL;
+    std::cerr << " -s  sample sheet (matrix_fn<TAB>group per line); matrices "
+                 "given as arguments form their own groups"
+              << ENDL;
+    std::cerr << " -d  max normalized depth to consider 'absent' ["
+              << EX_DAR_MAX_DEPTH << "]" << ENDL;
+    std::cerr << " -c  report only segments where another group has at least "
+                 "this mean normalized depth [disabled]"
+              << ENDL;
+    std::cerr << " -l  min segment length [" << EX_DAR_MIN_LENGTH << "]"
+              << ENDL;
+    std::cerr << " -b  number of bases read at once ["
+              << EX_DAR_BLOCK_SIZE << "]" << ENDL;
+    std::cerr << " -t  number of threads inflating the chunks of a block ["
+              << EX_DAR_NUM_THREADS << "]" << ENDL;
+    std::cerr << " -N  do not normalize depth by UniqueReadCount" << ENDL
+              << ENDL;
+    std::cerr << "Segments are written as BED intervals: 0-based start, "
+                 "exclusive end."
+              << ENDL << ENDL;
+    return;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    std::string sheetFn = "";
+    float maxDepth = EX_DAR_MAX_DEPTH, minCoverDepth = 0.0f;
+    int minLength = EX_DAR_MIN_LENGTH, blockSize = EX_DAR_BLOCK_SIZE;
+    int numThreads = EX_DAR_NUM_THREADS;
+    bool isNormalize = true;
+    // parse arguments
+    char option;
+    while ((option = getopt(argc, argv, "s:d:c:l:b:t:Nh")) != -1) {
+        switch (option) {
+            case 's':
+                sheetFn = optarg;
+                break;
+            case 'd':
+                maxDepth = std::atof(optarg);
+                break;
+            case 'c':
+                minCoverDepth = std::atof(optarg);
+                break;
+            case 'l':
+                minLength = std::atoi(optarg);
+                break;
+            case 'b':
+                blockSize = std::atoi(optarg);
+                if (0 >= blockSize) {
+                    std::cerr << WARNING_STRING
+                              << "block size must be a positive integer. "
+                                 "Using a default setting (-b "
+                              << EX_DAR_BLOCK_SIZE << ")." << ENDL;
+                    blockSize = EX_DAR_BLOCK_SIZE;
+                }
+                break;
+            case 't':
+                numThreads = std::atoi(optarg);
+                if (0 >= numThreads) {
+                    std::cerr << WARNING_STRING
+                              << "number of threads must be a positive "
+                                 "integer. Using a default setting (-t "
+                              << EX_DAR_NUM_THREADS << ")." << ENDL;
+                    numThreads = EX_DAR_NUM_THREADS;
+                }
+                break;
+            case 'N':
+                isNormalize = false;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                std::cerr << WARNING_STRING
+                          << "unknown option specified and ignored." << ENDL;
+                break;
+        }
+    }
+
+    // create input file list with the group of each matrix
+    hi::StringArray inputFiles, groupNames;
+    if (!sheetFn.empty() && !read_sample_sheet(sheetFn.c_str(), inputFiles,
+                                    groupNames)) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = optind; i < argc; ++i) {
+        inputFiles.push_back(argv[i]);
+        groupNames.push_back(argv[i]);
+    }
+    if (inputFiles.empty()) {
+        std::cerr << ERROR_STRING << "no input matrix specified." << ENDL
+                  << ENDL;
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const int nFiles = inputFiles.size();
+
+    std::vector<int> order;
+    SampleGroupArray groups;
+    make_sample_groups(groupNames, order, groups);
+
+    // input HDFs
+    HdfBaseDepthReader *hdfs = new HdfBaseDepthReader[nFiles];
+    if (!open_hdfs(inputFiles, hdfs)) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nFiles; ++i) {
+        hdfs[i].set_inflate_threads(numThreads);
+    }
+    hi::StringArray chromNames;
+    if (!hdfs[0].get_group_names(chromNames)) {
+        std::cerr << ERROR_STRING << "failed to list chromosomes in "
+                  << inputFiles[0] << ENDL;
+        exit(EXIT_FAILURE);
+    }
+
+    // normalization by library size
+    float *factors = new float[nFiles];
+    for (int i = 0; i < nFiles; ++i) {
+        factors[i] = 1.0f;
+    }
+    if (isNormalize
+            && !get_scale_factors(hdfs, nFiles, chromNames, factors)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // write header
+    std::cout << "#CHROM\tstart\tend\tlength\tgroup";
+    for (SampleGroupArray::const_iterator g = groups.begin();
+            g != groups.end(); ++g) {
+        std::cout << '\t' << g->name << ".normDepth";
+    }
+    std::cout << ENDL;
+
+    // process chromosomes
+    for (hi::StringArray::const_iterator chr = chromNames.begin();
+            chr != chromNames.end(); ++chr) {
+        int chromLength;
+        if (!set_chromosome(hdfs, nFiles, chr->c_str(), &chromLength)) {
+            std::cerr << WARNING_STRING << "seqid (" << *chr
+                      << ") is not available in all matrices. Skipped."
+                      << ENDL;
+            continue;
+        }
+        if (!detect_absent_regions(hdfs, order, groups, factors, chr->c_str(),
+                    chromLength, maxDepth, minCoverDepth, minLength, blockSize,
+                    std::cout)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // clean-up
+    for (int i = 0; i < nFiles; ++i) {
+        hdfs[i].close();
+    }
+    delete[] hdfs;
+    delete[] factors;
+    exit(EXIT_SUCCESS);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,704 @@
+#include "histd.h"
+
+#include "hdf_base_depth_reader.h"
+#include "ordered_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define EX_EXPORT_DATASET "BaseDepth"
+#define EX_EXPORT_NUM_THREADS 4
+// bases per block; a multiple of the largest zoom bin
+#define EX_EXPORT_BLOCK_SIZE 1048576
+// bases compared at once by the run-length scan
+#define EX_EXPORT_SCAN_GROUP 32
+// stream buffer of the bedGraph file
+#define EX_EXPORT_BUFFER_SIZE 4194304
+// formatted blocks per thread held for the ordered output
+#define EX_EXPORT_PENDING_BLOCKS 2
+
+// Binary zoomable track (little-endian)
+//   header     magic[8] "TBKMZOOM", uint32 version, numChroms, numLevels,
+//              baseBin, levelShift, reserved, uint64 directoryOffset
+//   zoom       per level, per chromosome: ceil(length / bin) ZoomRecord,
+//              where the bin of level k is baseBin << (levelShift * k)
+//   runs       per chromosome: RunRecord sorted by start
+//   directory  per chromosome: uint32 nameLength, name, int32 length,
+//              uint64 runOffset, numRuns, zoomOffset[numLevels]
+// Runs and bins are fixed-size records, so a region is found by a binary
+// search on the runs or by indexing the bins of the level.
+#define EX_EXPORT_MAGIC "TBKMZOOM"
+#define EX_EXPORT_VERSION 1
+#define EX_EXPORT_ZOOM_LEVELS 4
+#define EX_EXPORT_ZOOM_BASE_BIN 256
+#define EX_EXPORT_ZOOM_LEVEL_SHIFT 4
+#define EX_EXPORT_HEADER_SIZE 40
+
+//------------------------------------------------------------------------------
+struct RunRecord {
+    int32_t start, end, value;
+};
+struct ZoomRecord {
+    float mean;
+    int32_t min, max;
+};
+//------------------------------------------------------------------------------
+struct ChromInfo {
+    std::string name;
+    int length;
+    uint64_t zoomOffset[EX_EXPORT_ZOOM_LEVELS];
+    uint64_t runOffset, numRuns;
+};
+typedef std::vector<ChromInfo> ChromInfoArray;
+//------------------------------------------------------------------------------
+// The runs of a block end at its boundaries. The first and the last run are
+// left to RunMergeWriter, which joins them with the runs of the neighbouring
+// blocks; the runs in between are formatted by the export thread.
+struct ExportBlock {
+    int chrom, start, end;
+    int numBlockRuns;  // runs in [start, end); 0 when not exported
+    int firstEnd, lastStart;
+    IntType firstValue, lastValue;
+    long numRuns;  // runs written for the binary track
+};
+typedef std::vector<ExportBlock> ExportBlockArray;
+//------------------------------------------------------------------------------
+// state of an export thread; the array of them is the context of
+// run_ordered_blocks()
+struct ExportThreadParam {
+    HdfBaseDepthReader hdf;
+    RawChunkSet rawChunks;
+    std::string currentChrom;
+    const ChromInfoArray *chroms;
+    ExportBlockArray *blocks;
+    std::string dataName;
+    bool isAllRuns;
+    pthread_mutex_t *hdfMutex;
+    OrderedWriter *textWriter, *runWriter;  // NULL when not written
+    int zoomFd;                             // -1 when not written
+    bool isError;
+    std::vector<IntType> depth;
+    std::vector<int> changes;
+    std::string text, runs;
+};
+//------------------------------------------------------------------------------
+inline int get_zoom_bin(const int level) {
+    return EX_EXPORT_ZOOM_BASE_BIN << (EX_EXPORT_ZOOM_LEVEL_SHIFT * level);
+}
+//------------------------------------------------------------------------------
+// HDF5 is called under the shared mutex; the serial library is not
+// thread-safe. Long reads are fetched as raw chunks and inflated after the
+// mutex is released, so the threads decode in parallel.
+bool read_depth(ExportThreadParam *p, const ChromInfo &chrom, const int start,
+        const int count, IntType *buffer) {
+    pthread_mutex_lock(p->hdfMutex);
+    bool isSuccess = true;
+    if (chrom.name != p->currentChrom) {
+        p->currentChrom = "";
+        isSuccess = p->hdf.set_target_chromosome(chrom.name.c_str())
+                && p->hdf.set_target_dataset(
+                        p->dataName.c_str(), H5::PredType::STD_I32LE);
+        if (isSuccess)
+            p->currentChrom = chrom.name;
+    }
+    const bool isRaw = isSuccess && p->hdf.can_read_raw_chunks()
+            && EX_HDFBDR_INFLATE_MIN_CHUNKS * p->hdf.get_chunk_size()
+                    <= count;
+    if (isRaw) {
+        isSuccess = p->hdf.read_raw_chunks(&start, &count, p->rawChunks);
+    } else if (isSuccess) {
+        isSuccess = p->hdf.get_matrix(&start, &count, buffer);
+    }
+    pthread_mutex_unlock(p->hdfMutex);
+    if (isSuccess && isRaw)
+        isSuccess = inflate_chunks(p->rawChunks, buffer, 1);
+    if (!isSuccess) {
+        std::cerr << ERROR_STRING << "failed to read " << p->dataName
+                  << " of '" << chrom.name << "' at " << start << "." << ENDL;
+    }
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+// Positions in (from, to) where the depth differs from the previous base.
+// Groups of EX_EXPORT_SCAN_GROUP bases are tested with an OR of XORs, which
+// the compiler vectorizes, and only groups with a change are looked into.
+void find_changes(const IntType *depth, const int from, const int to,
+        std::vector<int> &changes) {
+    int pos = from + 1;
+    while (pos < to) {
+        if (pos + EX_EXPORT_SCAN_GROUP <= to) {
+            IntType diff = 0;
+            for (int k = 0; k < EX_EXPORT_SCAN_GROUP; ++k)
+                diff |= depth[pos + k] ^ depth[pos + k - 1];
+            if (0 == diff) {
+                pos += EX_EXPORT_SCAN_GROUP;
+                continue;
+            }
+        }
+        const int groupEnd = std::min(to, pos + EX_EXPORT_SCAN_GROUP);
+        for (; pos < groupEnd; ++pos) {
+            if (depth[pos] != depth[pos - 1])
+                changes.push_back(pos);
+        }
+    }
+}
+//------------------------------------------------------------------------------
+void append_int(std::string &text, long value) {
+    char digits[24];
+    int n = 0;
+    const bool isNegative = (0 > value);
+    if (isNegative)
+        value = -value;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (0 < value);
+    if (isNegative)
+        text += '-';
+    while (0 < n)
+        text += digits[--n];
+}
+//------------------------------------------------------------------------------
+void append_run(std::string &text, const std::string &chromName,
+        const int start, const int end, const IntType value) {
+    text += chromName;
+    text += '\t';
+    append_int(text, start);
+    text += '\t';
+    append_int(text, end);
+    text += '\t';
+    append_int(text, value);
+    text += '\n';
+}
+//------------------------------------------------------------------------------
+void append_run_record(std::string &runs, const int start, const int end,
+        const IntType value) {
+    RunRecord record;
+    record.start = start;
+    record.end = end;
+    record.value = value;
+    runs.append((const char *)&record, sizeof(record));
+}
+//------------------------------------------------------------------------------
+// mean, min and max of the bins of each level in [start, end); bins of a
+// level are built from the 2^levelShift bins of the level below
+void make_zoom_records(const IntType *depth, const int start, const int end,
+        std::vector<ZoomRecord> *levels) {
+    const int baseBin = get_zoom_bin(0);
+    std::vector<long> sums, counts;
+    for (int binStart = start; binStart < end; binStart += baseBin) {
+        const int n = std::min(baseBin, end - binStart);
+        const IntType *d = depth + (binStart - start);
+        long sum = 0;
+        IntType minDepth = d[0], maxDepth = d[0];
+        for (int i = 0; i < n; ++i) {
+            sum += d[i];
+            minDepth = std::min(minDepth, d[i]);
+            maxDepth = std::max(maxDepth, d[i]);
+        }
+        ZoomRecord record;
+        record.mean = (float)sum / n;
+        record.min = minDepth;
+        record.max = maxDepth;
+        levels[0].push_back(record);
+        sums.push_back(sum);
+        counts.push_back(n);
+    }
+
+    const int fanout = 1 << EX_EXPORT_ZOOM_LEVEL_SHIFT;
+    for (int level = 1; level < EX_EXPORT_ZOOM_LEVELS; ++level) {
+        std::vector<long> levelSums, levelCounts;
+        const std::vector<ZoomRecord> &lower = levels[level - 1];
+        for (size_t first = 0; first < lower.size(); first += fanout) {
+            const size_t last = std::min(lower.size(), first + fanout);
+            ZoomRecord record = lower[first];
+            long sum = 0, count = 0;
+            for (size_t j = first; j < last; ++j) {
+                sum += sums[j];
+                count += counts[j];
+                record.min = std::min(record.min, lower[j].min);
+                record.max = std::max(record.max, lower[j].max);
+            }
+            record.mean = (float)sum / count;
+            levels[level].push_back(record);
+            levelSums.push_back(sum);
+            levelCounts.push_back(count);
+        }
+        sums.swap(levelSums);
+        counts.swap(levelCounts);
+    }
+}
+//------------------------------------------------------------------------------
+bool write_at(const int fd, const void *data, const size_t size,
+        const uint64_t offset) {
+    const char *ptr = (const char *)data;
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t n
+                = pwrite(fd, ptr + written, size - written, offset + written);
+        if (0 > n && EINTR == errno)
+            continue;
+        if (0 >= n)
+            return false;
+        written += n;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// Runs of the block cut at its boundaries. Only the depth of the block is
+// read, so a long run spanning many blocks is read once, and the first and the
+// last run are left in 'block' for RunMergeWriter to join across blocks.
+bool export_block(ExportThreadParam *p, ExportBlock &block,
+        std::vector<IntType> &depth, std::vector<int> &changes,
+        std::string &text, std::string &runs) {
+    const ChromInfo &chrom = (*p->chroms)[block.chrom];
+    block.numBlockRuns = 0;
+    block.numRuns = 0;
+    const int count = block.end - block.start;
+    if (!read_depth(p, chrom, block.start, count, depth.data()))
+        return false;
+
+    changes.clear();
+    changes.push_back(0);
+    find_changes(depth.data(), 0, count, changes);
+    const int numBlockRuns = changes.size();
+    for (int i = 1; i + 1 < numBlockRuns; ++i) {
+        const IntType value = depth[changes[i]];
+        if (0 == value && !p->isAllRuns)
+            continue;
+        const int runStart = block.start + changes[i];
+        const int runEnd = block.start + changes[i + 1];
+        if (NULL != p->textWriter)
+            append_run(text, chrom.name, runStart, runEnd, value);
+        if (NULL != p->runWriter) {
+            append_run_record(runs, runStart, runEnd, value);
+            ++block.numRuns;
+        }
+    }
+    block.firstEnd
+            = block.start + ((1 < numBlockRuns) ? changes[1] : count);
+    block.firstValue = depth[0];
+    block.lastStart = block.start + changes.back();
+    block.lastValue = depth[changes.back()];
+    block.numBlockRuns = numBlockRuns;
+
+    // zoom bins of the block go straight to their place in the file
+    if (0 <= p->zoomFd) {
+        std::vector<ZoomRecord> levels[EX_EXPORT_ZOOM_LEVELS];
+        make_zoom_records(depth.data(), block.start, block.end, levels);
+        for (int level = 0; level < EX_EXPORT_ZOOM_LEVELS; ++level) {
+            const uint64_t index = block.start / get_zoom_bin(level);
+            if (!write_at(p->zoomFd, levels[level].data(),
+                        levels[level].size() * sizeof(ZoomRecord),
+                        chrom.zoomOffset[level]
+                                + index * sizeof(ZoomRecord))) {
+                std::cerr << ERROR_STRING << "failed to write zoom records."
+                          << ENDL;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+bool export_thread_block(void *context, const int thread, const long b) {
+    ExportThreadParam *p = (ExportThreadParam *)context + thread;
+    // a failed block is still put so that the later ones are written
+    p->text.clear();
+    p->runs.clear();
+    if (!p->isError
+            && !export_block(p, (*p->blocks)[b], p->depth, p->changes,
+                    p->text, p->runs))
+        p->isError = true;
+    if (NULL != p->textWriter)
+        p->textWriter->put(b, p->text);
+    if (NULL != p->runWriter)
+        p->runWriter->put(b, p->runs);
+    return !p->isError;
+}
+//------------------------------------------------------------------------------
+// OrderedWriter of the bedGraph or the runs of the binary track. It holds the
+// last run of the blocks written so far and extends it by the first run of the
+// next block when the two have the same value on the same chromosome, so runs
+// spanning blocks are written once. The runs of the binary track are counted
+// to the blocks they start in.
+class RunMergeWriter : public OrderedWriter {
+public:
+    void set_blocks(ExportBlockArray *blocks, const ChromInfoArray *chroms,
+            const bool isBinary, const bool isAllRuns) {
+        this->blocks = blocks;
+        this->chroms = chroms;
+        this->isBinary = isBinary;
+        this->isAllRuns = isAllRuns;
+        openBlock = -1;
+    }
+
+protected:
+    virtual void write_block(const long sequence, const std::string &block);
+    virtual void write_end(void) { write_open_run(); }
+    void write_open_run(void);
+
+    ExportBlockArray *blocks;
+    const ChromInfoArray *chroms;
+    bool isBinary, isAllRuns;
+    long openBlock;  // block where the open run starts; -1 when none
+    int openStart, openEnd;
+    IntType openValue;
+    std::string edge;
+};
+//------------------------------------------------------------------------------
+void RunMergeWriter::write_open_run(void) {
+    if (0 > openBlock)
+        return;
+    ExportBlock &start = (*blocks)[openBlock];
+    openBlock = -1;
+    if (0 == openValue && !isAllRuns)
+        return;
+    edge.clear();
+    if (isBinary) {
+        append_run_record(edge, openStart, openEnd, openValue);
+        ++start.numRuns;
+    } else {
+        append_run(edge, (*chroms)[start.chrom].name, openStart, openEnd,
+                openValue);
+    }
+    ost->write(edge.data(), edge.length());
+}
+//------------------------------------------------------------------------------
+void RunMergeWriter::write_block(
+        const long sequence, const std::string &block) {
+    const ExportBlock &current = (*blocks)[sequence];
+    if (0 == current.numBlockRuns) {
+        // a failed block; the open run is not extended over it
+        write_open_run();
+        return;
+    }
+    if (0 <= openBlock && (*blocks)[openBlock].chrom == current.chrom
+            && openEnd == current.start && openValue == current.firstValue) {
+        openEnd = current.firstEnd;
+    } else {
+        write_open_run();
+        openBlock = sequence;
+        openStart = current.start;
+        openEnd = current.firstEnd;
+        openValue = current.firstValue;
+    }
+    if (1 < current.numBlockRuns) {
+        write_open_run();
+        ost->write(block.data(), block.length());
+        openBlock = sequence;
+        openStart = current.lastStart;
+        openEnd = current.end;
+        openValue = current.lastValue;
+    }
+}
+//------------------------------------------------------------------------------
+// Chromosomes in the order of a chrom.sizes or .fai file (first column), or
+// in the order of the groups of the matrix when no file is given. HDF5 lists
+// those by name (chr1, chr10, chr2, ...), not in the BAM reference order.
+// Lengths come from the matrix.
+bool get_chromosomes(const char *matrixFn, const std::string &orderFn,
+        const std::string &dataName, ChromInfoArray &chroms) {
+    HdfBaseDepthReader hdf;
+    hi::StringArray names;
+    if (!hdf.open(matrixFn) || !hdf.get_group_names(names)) {
+        std::cerr << ERROR_STRING << "failed to list chromosomes in "
+                  << matrixFn << "." << ENDL;
+        return false;
+    }
+    if (!orderFn.empty()) {
+        std::ifstream infile(orderFn.c_str());
+        if (infile.fail()) {
+            std::cerr << ERROR_STRING << "failed to open " << orderFn << "."
+                      << ENDL;
+            return false;
+        }
+        names.clear();
+        std::string line;
+        while (std::getline(infile, line)) {
+            if (line.empty() || '#' == line[0])
+                continue;
+            names.push_back(line.substr(0, line.find('\t')));
+        }
+    }
+
+    for (hi::StringArray::const_iterator name = names.begin();
+            name != names.end(); ++name) {
+        if (!hdf.set_target_chromosome(name->c_str())
+                || !hdf.set_target_dataset(
+                        dataName.c_str(), H5::PredType::STD_I32LE)) {
+            std::cerr << WARNING_STRING << "'" << *name << "' has no "
+                      << dataName << " in the matrix. Skipped." << ENDL;
+            continue;
+        }
+        ChromInfo chrom;
+        chrom.name = *name;
+        chrom.length = hdf.get_num_elements();
+        chrom.runOffset = chrom.numRuns = 0;
+        chroms.push_back(chrom);
+    }
+    hdf.close();
+    return true;
+}
+//------------------------------------------------------------------------------
+// zoom sections follow the header; returns the offset of the runs
+uint64_t layout_zoom(ChromInfoArray &chroms) {
+    uint64_t offset = EX_EXPORT_HEADER_SIZE;
+    for (int level = 0; level < EX_EXPORT_ZOOM_LEVELS; ++level) {
+        const int bin = get_zoom_bin(level);
+        for (size_t c = 0; c < chroms.size(); ++c) {
+            chroms[c].zoomOffset[level] = offset;
+            offset += (uint64_t)((chroms[c].length + bin - 1) / bin)
+                    * sizeof(ZoomRecord);
+        }
+    }
+    return offset;
+}
+//------------------------------------------------------------------------------
+bool write_track_index(const int fd, ChromInfoArray &chroms,
+        const ExportBlockArray &blocks, const uint64_t runOffset) {
+    for (size_t b = 0; b < blocks.size(); ++b)
+        chroms[blocks[b].chrom].numRuns += blocks[b].numRuns;
+    uint64_t offset = runOffset;
+    for (size_t c = 0; c < chroms.size(); ++c) {
+        chroms[c].runOffset = offset;
+        offset += chroms[c].numRuns * sizeof(RunRecord);
+    }
+
+    std::string directory;
+    for (size_t c = 0; c < chroms.size(); ++c) {
+        const uint32_t nameLength = chroms[c].name.length();
+        const int32_t length = chroms[c].length;
+        directory.append((const char *)&nameLength, sizeof(nameLength));
+        directory += chroms[c].name;
+        directory.append((const char *)&length, sizeof(length));
+        directory.append(
+                (const char *)&chroms[c].runOffset, sizeof(uint64_t));
+        directory.append((const char *)&chroms[c].numRuns, sizeof(uint64_t));
+        directory.append((const char *)chroms[c].zoomOffset,
+                sizeof(uint64_t) * EX_EXPORT_ZOOM_LEVELS);
+    }
+
+    char header[EX_EXPORT_HEADER_SIZE];
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header, EX_EXPORT_MAGIC, 8);
+    const uint32_t fields[6] = {EX_EXPORT_VERSION, (uint32_t)chroms.size(),
+            EX_EXPORT_ZOOM_LEVELS, EX_EXPORT_ZOOM_BASE_BIN,
+            EX_EXPORT_ZOOM_LEVEL_SHIFT, 0};
+    std::memcpy(header + 8, fields, sizeof(fields));
+    std::memcpy(header + 32, &offset, sizeof(offset));
+    return write_at(fd, directory.data(), directory.length(), offset)
+            && write_at(fd, header, sizeof(header), 0);
+}
+//------------------------------------------------------------------------------
+// Blocks of all chromosomes are shared by the threads, each with its own
+// reader, and written in the order of 'chroms' by RunMergeWriters.
+bool export_track(const char *matrixFn, ChromInfoArray &chroms,
+        const std::string &dataName, const bool isAllRuns,
+        const int numThreads, std::ostream *textOst,
+        const std::string &binaryFn) {
+    ExportBlockArray blocks;
+    for (size_t c = 0; c < chroms.size(); ++c) {
+        for (int start = 0; start < chroms[c].length;
+                start += EX_EXPORT_BLOCK_SIZE) {
+            ExportBlock block;
+            block.chrom = c;
+            block.start = start;
+            block.end = std::min(chroms[c].length,
+                    start + EX_EXPORT_BLOCK_SIZE);
+            block.numBlockRuns = 0;
+            block.numRuns = 0;
+            blocks.push_back(block);
+        }
+    }
+    const int nThreads
+            = std::max(1, std::min(numThreads, (int)blocks.size()));
+
+    // binary track: zoom records by offset, runs in order after them
+    int zoomFd = -1;
+    uint64_t runOffset = 0;
+    std::ofstream runOst;
+    if (!binaryFn.empty()) {
+        runOffset = layout_zoom(chroms);
+        zoomFd = open(binaryFn.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (0 <= zoomFd) {
+            runOst.open(binaryFn.c_str(),
+                    std::ios::in | std::ios::out | std::ios::binary);
+            runOst.seekp(runOffset);
+        }
+        if (0 > zoomFd || runOst.fail()) {
+            std::cerr << ERROR_STRING << "can't open " << binaryFn
+                      << " for writing." << ENDL;
+            if (0 <= zoomFd)
+                close(zoomFd);
+            return false;
+        }
+    }
+
+    const int maxPending = nThreads * EX_EXPORT_PENDING_BLOCKS;
+    RunMergeWriter textWriter, runWriter;
+    textWriter.set_blocks(&blocks, &chroms, false, isAllRuns);
+    runWriter.set_blocks(&blocks, &chroms, true, isAllRuns);
+    bool isError = (NULL != textOst && !textWriter.start(textOst, maxPending))
+            || (0 <= zoomFd && !runWriter.start(&runOst, maxPending));
+
+    pthread_mutex_t hdfMutex;
+    pthread_mutex_init(&hdfMutex, NULL);
+    ExportThreadParam *param = new ExportThreadParam[nThreads];
+    for (int i = 0; i < nThreads && !isError; ++i) {
+        param[i].chroms = &chroms;
+        param[i].blocks = &blocks;
+        param[i].dataName = dataName;
+        param[i].isAllRuns = isAllRuns;
+        param[i].hdfMutex = &hdfMutex;
+        param[i].textWriter = (NULL != textOst) ? &textWriter : NULL;
+        param[i].runWriter = (0 <= zoomFd) ? &runWriter : NULL;
+        param[i].zoomFd = zoomFd;
+        param[i].isError = false;
+        param[i].depth.resize(EX_EXPORT_BLOCK_SIZE);
+        if (!param[i].hdf.open(matrixFn)) {
+            std::cerr << ERROR_STRING << "failed to open " << matrixFn << "."
+                      << ENDL;
+            isError = true;
+        }
+    }
+    if (!isError
+            && !run_ordered_blocks(
+                    blocks.size(), nThreads, export_thread_block, param))
+        isError = true;
+    if (NULL != textOst && !textWriter.finish())
+        isError = true;
+    if (0 <= zoomFd) {
+        if (!runWriter.finish())
+            isError = true;
+        runOst.close();
+        if (!isError && !write_track_index(zoomFd, chroms, blocks, runOffset)) {
+            std::cerr << ERROR_STRING << "failed to write the index of "
+                      << binaryFn << "." << ENDL;
+            isError = true;
+        }
+        close(zoomFd);
+    }
+
+    for (int i = 0; i < nThreads; ++i)
+        param[i].hdf.close();
+    delete[] param;
+    pthread_mutex_destroy(&hdfMutex);
+    return !isError;
+}
+//------------------------------------------------------------------------------
+void print_usage(const char *cmd) {
+    std::cerr << USAGE_STRING << cmd << " (options) matrix" << ENDL;
+    std::cerr << "Available options:" << ENDL;
+    std::cerr << " -o  bedGraph output filename ('-' for stdout)" << ENDL;
+    std::cerr << " -z  binary zoomable track output filename" << ENDL;
+    std::cerr << " -d  depth track to export [" << EX_EXPORT_DATASET << "]"
+              << ENDL;
+    std::cerr << " -r  chrom.sizes or .fai listing the chromosomes in order "
+                 "[matrix group order, sorted by name]"
+              << ENDL;
+    std::cerr << " -a  also write zero-depth runs" << ENDL;
+    std::cerr << " -t  number of threads [" << EX_EXPORT_NUM_THREADS << "]"
+              << ENDL
+              << ENDL;
+    std::cerr << "Runs of equal depth are written as 0-based, half-open "
+                 "matrix offsets."
+              << ENDL << "At least one of -o and -z is required." << ENDL
+              << ENDL;
+    return;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    std::string textFn = "", binaryFn = "", orderFn = "";
+    std::string dataName = EX_EXPORT_DATASET;
+    int numThreads = EX_EXPORT_NUM_THREADS;
+    bool isAllRuns = false;
+    // parse arguments
+    char option;
+    while ((option = getopt(argc, argv, "o:z:d:r:at:h")) != -1) {
+        switch (option) {
+            case 'o':
+                textFn = optarg;
+                break;
+            case 'z':
+                binaryFn = optarg;
+                break;
+            case 'd':
+                dataName = optarg;
+                break;
+            case 'r':
+                orderFn = optarg;
+                break;
+            case 'a':
+                isAllRuns = true;
+                break;
+            case 't':
+                numThreads = std::atoi(optarg);
+                if (0 >= numThreads) {
+                    std::cerr << WARNING_STRING
+                              << "number of threads must be a positive "
+                                 "integer. Using a default setting (-t "
+                              << EX_EXPORT_NUM_THREADS << ")." << ENDL;
+                    numThreads = EX_EXPORT_NUM_THREADS;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                std::cerr << WARNING_STRING
+                          << "unknown option specified and ignored." << ENDL;
+                break;
+        }
+    }
+
+    // check mandatory arguments
+    if (optind + 1 != argc || (textFn.empty() && binaryFn.empty())) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *matrixFn = argv[optind];
+
+    H5::Exception::dontPrint();
+    ChromInfoArray chroms;
+    if (!get_chromosomes(matrixFn, orderFn, dataName, chroms)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // bedGraph through a large stream buffer
+    std::ofstream textFile;
+    std::vector<char> textBuffer(EX_EXPORT_BUFFER_SIZE);
+    std::ostream *textOst = NULL;
+    if ("-" == textFn) {
+        textOst = &std::cout;
+    } else if (!textFn.empty()) {
+        textFile.rdbuf()->pubsetbuf(textBuffer.data(), textBuffer.size());
+        textFile.open(textFn.c_str());
+        if (textFile.fail()) {
+            std::cerr << ERROR_STRING << "can't open " << textFn
+                      << " for writing." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        textOst = &textFile;
+    }
+
+    bool isSuccess = export_track(matrixFn, chroms, dataName, isAllRuns,
+            numThreads, textOst, binaryFn);
+    if (textFile.is_open()) {
+        textFile.close();
+        isSuccess = isSuccess && !textFile.fail();
+    }
+    exit(isSuccess ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+//------------------------------------------------------------------------------
@@ -1,149 +1,579 @@
 #include "histd.h"
 
+#include "coverage_query.h"
 #include "gfflib.h"
-#include "hdf_base_depth_reader.h"
+#include "ordered_writer.h"
+#include "stage_stats.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <getopt.h>
 #include <iostream>
+#include <map>
 #include <numeric>
+#include <pthread.h>
 #include <sstream>
 #include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <vector>
 
-#define EX_GFFC_MIN_DEPTH 5
+#define EX_GFFC_MIN_DEPTH EX_COVQ_MIN_DEPTH
+#define EX_GFFC_NUM_THREADS 4
+// records queried at once; bounds the memory of the statistics
+#define EX_GFFC_BLOCK_SIZE 4096
+// formatted blocks per thread held for the ordered output
+#define EX_GFFC_PENDING_BLOCKS 2
+
+// long-only options
+#define EX_GFFC_OPTION_STATS 256
+#define EX_GFFC_OPTION_PROGRESS 257
+
+// server mode
+#define EX_GFFC_SERVER_BACKLOG 16
+#define EX_GFFC_SERVER_BUFFER_SIZE 65536
+#define EX_GFFC_OPTION_MIN_DEPTH "#minDepth"
 //------------------------------------------------------------------------------
-bool set_chromosome(
-        HdfBaseDepthReader *hdf, const int nFiles, const char *chromName) {
-    for (int i = 0; i < nFiles; ++i) {
-        if (!hdf[i].set_target_chromosome(chromName)
-                || !hdf[i].set_target_dataset(
-                        "BaseDepth", H5::PredType::STD_I32LE))
-            return false;
+void add_region(const std::string &seqid, const int start, const int end,
+        CoverageRegionArray &regions) {
+    CoverageRegion region;
+    region.seqid = seqid;
+    region.start = start;
+    region.end = end;
+    regions.push_back(region);
+    return;
+}
+//------------------------------------------------------------------------------
+// Rows of the records with statistics; records on a chromosome missing from
+// any matrix are skipped, or reported as '#skipped' lines when isMarked.
+void write_record_coverage(const GffRecord *records, const size_t nRecords,
+        const CoverageStatArray &stats, const int nSamples,
+        const bool isMarked, std::ostream &ofs) {
+    const char sep = '\t';
+    for (size_t r = 0; r < nRecords; ++r) {
+        const CoverageStat *stat = &stats[r * nSamples];
+        bool isFound = true;
+        for (int i = 0; i < nSamples; ++i)
+            isFound = isFound && stat[i].isFound;
+        if (!isFound) {
+            if (isMarked)
+                ofs << "#skipped" << sep << records[r] << ENDL;
+            continue;
+        }
+        // write results
+        ofs << records[r];
+        for (int i = 0; i < nSamples; ++i) {
+            ofs << sep << stat[i].get_avg_depth() << sep
+                << stat[i].coveredBases << sep
+                << stat[i].get_covered_fraction();
+        }
+        ofs << ENDL;
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+// rows of the records [first, last); the formatting is timed into 'format'
+// when given
+bool format_record_block(CoverageQuery &query, const GffRecordArray &records,
+        const size_t first, const size_t last, std::ostream &ofs,
+        StageCounter *format) {
+    CoverageRegionArray regions;
+    CoverageStatArray stats;
+    for (size_t r = first; r < last; ++r) {
+        add_region(records[r].seqid, records[r].start, records[r].end,
+                regions);
     }
+    if (!query.query(regions, stats))
+        return false;
+    StageTimer timer;
+    if (NULL != format)
+        timer.start();
+    write_record_coverage(&records[first], last - first, stats,
+            query.get_num_samples(), false, ofs);
+    if (NULL != format)
+        timer.stop(format, 0, last - first);
     return true;
 }
 //------------------------------------------------------------------------------
-bool open_hdfs(const hi::StringArray &inputFiles, HdfBaseDepthReader *hdfs) {
-    bool isError = false;
-    for (hi::StringArray::const_iterator fn = inputFiles.begin();
-            fn != inputFiles.end(); ++fn) {
-        const int pos = std::distance(inputFiles.begin(), fn);
-        if (!hdfs[pos].open(fn->c_str())) {
-            std::cerr << WARNING_STRING << "failed to open an input HDF ("
-                      << *fn << "). [code: " << __LINE__ << "]" << ENDL;
-            isError = true;
+// GFF records sharing an attribute value (e.g. the exons of a gene) on one
+// chromosome, with their intervals merged into a union
+struct FeatureGroup {
+    std::string id, seqid;
+    char strand;
+    std::vector<std::pair<int, int> > intervals;  // 1-based, inclusive
+};
+typedef std::vector<FeatureGroup> FeatureGroupArray;
+//------------------------------------------------------------------------------
+void merge_intervals(std::vector<std::pair<int, int> > &intervals) {
+    if (intervals.empty())
+        return;
+    std::sort(intervals.begin(), intervals.end());
+    size_t last = 0;
+    for (size_t i = 1; i < intervals.size(); ++i) {
+        if (intervals[i].first <= intervals[last].second + 1) {
+            intervals[last].second
+                    = std::max(intervals[last].second, intervals[i].second);
+        } else {
+            intervals[++last] = intervals[i];
         }
     }
-    if (isError) {
+    intervals.resize(last + 1);
+    return;
+}
+//------------------------------------------------------------------------------
+void make_feature_groups(const GffRecordArray &records,
+        const std::string &groupKey, const std::string &featureType,
+        FeatureGroupArray &groups) {
+    std::map<std::string, int> groupIndex;
+    int nMissing = 0;
+    for (GffRecordArray::const_iterator record = records.begin();
+            record != records.end(); ++record) {
+        if (!featureType.empty() && featureType != record->type)
+            continue;
+        std::string value;
+        if (!get_attribute_item(record->attributes, groupKey, value)) {
+            ++nMissing;
+            continue;
+        }
+        // an exon may be shared by several parents, e.g. Parent=t1,t2
+        hi::StringArray ids;
+        hi::split(ids, value, ',', hi::HISTD_SPLITMODE_NOEMPTY);
+        for (hi::StringArray::const_iterator id = ids.begin();
+                id != ids.end(); ++id) {
+            const std::string key = record->seqid + '\t' + *id;
+            std::map<std::string, int>::iterator hit = groupIndex.find(key);
+            if (groupIndex.end() == hit) {
+                FeatureGroup group;
+                group.id = *id;
+                group.seqid = record->seqid;
+                group.strand = record->strand;
+                hit = groupIndex
+                              .insert(std::pair<std::string, int>(
+                                      key, groups.size()))
+                              .first;
+                groups.push_back(group);
+            }
+            groups[hit->second].intervals.push_back(
+                    std::pair<int, int>(record->start, record->end));
+        }
+    }
+    for (FeatureGroupArray::iterator group = groups.begin();
+            group != groups.end(); ++group) {
+        merge_intervals(group->intervals);
+    }
+    if (0 < nMissing) {
+        std::cerr << WARNING_STRING << nMissing << " record(s) without '"
+                  << groupKey << "' attribute were skipped." << ENDL;
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+// Rows of the groups [first, last). Each base of a union is read once per
+// sample.
+bool format_group_block(CoverageQuery &query, const FeatureGroupArray &groups,
+        const size_t first, const size_t last, std::ostream &ofs,
+        StageCounter *format) {
+    const char sep = '\t';
+    const int nSamples = query.get_num_samples();
+    CoverageRegionArray regions;
+    CoverageStatArray stats;
+    std::vector<long> totalDepth(nSamples);
+    std::vector<int> coveredBases(nSamples);
+
+    for (size_t g = first; g < last; ++g) {
+        for (std::vector<std::pair<int, int> >::const_iterator interval
+                = groups[g].intervals.begin();
+                interval != groups[g].intervals.end(); ++interval) {
+            add_region(groups[g].seqid, interval->first, interval->second,
+                    regions);
+        }
+    }
+    if (!query.query(regions, stats))
         return false;
+
+    StageTimer timer;
+    if (NULL != format)
+        timer.start();
+    const CoverageStat *stat = stats.data();
+    for (size_t g = first; g < last; ++g) {
+        const FeatureGroup &group = groups[g];
+        int unionLength = 0;
+        bool isFound = true;
+        std::fill(totalDepth.begin(), totalDepth.end(), 0);
+        std::fill(coveredBases.begin(), coveredBases.end(), 0);
+        for (size_t k = 0; k < group.intervals.size(); ++k) {
+            unionLength
+                    += group.intervals[k].second - group.intervals[k].first + 1;
+            for (int i = 0; i < nSamples; ++i) {
+                isFound = isFound && stat[i].isFound;
+                totalDepth[i] += stat[i].totalDepth;
+                coveredBases[i] += stat[i].coveredBases;
+            }
+            stat += nSamples;
+        }
+        if (!isFound)
+            continue;
+
+        // write results
+        ofs << group.seqid << sep << group.intervals.front().first << sep
+            << group.intervals.back().second << sep << group.strand << sep
+            << group.id << sep << group.intervals.size() << sep
+            << unionLength;
+        for (int i = 0; i < nSamples; ++i) {
+            ofs << sep << (float)totalDepth[i] / (float)unionLength << sep
+                << coveredBases[i] << sep
+                << (float)coveredBases[i] / (float)unionLength;
+        }
+        ofs << ENDL;
     }
+    if (NULL != format)
+        timer.stop(format, 0, last - first);
     return true;
 }
 //------------------------------------------------------------------------------
-void init_buffer(int *coveredBases, float *avgDepth, const int nElements,
-        const int value = 0) {
-    for (int i = 0; i < nElements; ++i) {
-        coveredBases[i] = value;
-        avgDepth[i] = (float)value;
+// [first, last) of the records or groups formatted by one worker
+struct OutputBlock {
+    size_t first, last;
+};
+typedef std::vector<OutputBlock> OutputBlockArray;
+//------------------------------------------------------------------------------
+// blocks of EX_GFFC_BLOCK_SIZE records, or of groups with about as many
+// intervals
+void make_output_blocks(const size_t nItems, const FeatureGroupArray *groups,
+        OutputBlockArray &blocks) {
+    OutputBlock block;
+    block.first = 0;
+    while (block.first < nItems) {
+        block.last = block.first;
+        size_t nIntervals = 0;
+        while (block.last < nItems && EX_GFFC_BLOCK_SIZE > nIntervals) {
+            nIntervals += (NULL == groups)
+                    ? 1
+                    : std::max((size_t)1,
+                              (*groups)[block.last].intervals.size());
+            ++block.last;
+        }
+        blocks.push_back(block);
+        block.first = block.last;
     }
     return;
 }
 //------------------------------------------------------------------------------
-bool get_cover_stat(HdfBaseDepthReader &hdf, const int *start,
-        const int *szRegion, int *coveredBases, const int minDepth,
-        float *avgDepth) {
-    IntType *matrix = new IntType[*szRegion];
-    if (!hdf.get_matrix(start, szRegion, matrix)) {
-        std::cerr << WARNING_STRING
-                  << "failed to fetch a matrix. start=" << *start
-                  << ", size=" << szRegion << ENDL;
-        return false;
+void write_header(const hi::StringArray &sampleNames, std::ostream &ofs) {
+    ofs << "#CHROM\tsource\ttype\tstart\tend\tscore\tstrand\tphase"
+           "\tattributes";
+    for (hi::StringArray::const_iterator name = sampleNames.begin();
+            name != sampleNames.end(); ++name) {
+        ofs << '\t' << *name << ".avgDepth\t" << *name << ".coveredBases\t"
+            << *name << ".coveredFrac";
     }
-    // counting
-    int totalDP = 0;
-    for (int pos = 0; pos < *szRegion; ++pos) {
-        if (minDepth <= matrix[pos]) {
-            *coveredBases += 1;
-        }
-        totalDP += matrix[pos];
+    ofs << ENDL;
+    return;
+}
+//------------------------------------------------------------------------------
+// state of a coverage thread; the array of them is the context of
+// run_ordered_blocks()
+struct CoverageThreadParam {
+    CoverageQuery query;
+    const GffRecordArray *records;
+    const FeatureGroupArray *groups;  // NULL for one row per record
+    const OutputBlockArray *blocks;
+    OrderedWriter *writer;
+    StageStats *stats;  // NULL unless --stats or --progress is given
+    std::string threadName;
+    std::ostringstream ost;
+    std::string text;
+    StageCounter format;
+};
+//------------------------------------------------------------------------------
+bool determine_block_coverage(void *context, const int thread, const long b) {
+    CoverageThreadParam *param = (CoverageThreadParam *)context + thread;
+    const OutputBlockArray &blocks = *param->blocks;
+    StageCounter *formatCounter
+            = (NULL == param->stats) ? NULL : &param->format;
+
+    // a failed block is still put so that the later ones are written
+    param->ost.str("");
+    const bool isSuccess = (NULL == param->groups)
+            ? format_record_block(param->query, *param->records,
+                      blocks[b].first, blocks[b].last, param->ost,
+                      formatCounter)
+            : format_group_block(param->query, *param->groups,
+                      blocks[b].first, blocks[b].last, param->ost,
+                      formatCounter);
+    param->text = param->ost.str();
+    if (NULL != param->stats) {
+        param->format.bytes += param->text.length();
+        param->stats->add_progress(blocks[b].last - blocks[b].first, 1);
     }
-    *avgDepth = (float)totalDP / (float)*szRegion;
-    delete[] matrix;
-    return true;
+    param->writer->put(b, param->text);
+    return isSuccess;
 }
 //------------------------------------------------------------------------------
-bool get_cover_stat(HdfBaseDepthReader *hdfs, const int nFiles,
-        const int *start, const int *szRegion, int *coveredBases,
-        const int minDepth, float *avgDepth) {
+// Blocks of records (or groups when 'groups' is given) are computed and
+// formatted by the threads, each with its own readers, and written in their
+// original order by an OrderedWriter while the threads go on. HDF5 calls are
+// serialized by one mutex shared by all readers; chunks of long regions are
+// inflated outside it. The numThreads threads are split between the workers
+// and their inflation, so that no more than numThreads decode at once.
+bool determine_coverage(const hi::StringArray &inputFiles, const int minDepth,
+        const int numThreads, const GffRecordArray &records,
+        const FeatureGroupArray *groups, std::ostream &ofs, StageStats *stats,
+        const double progressInterval) {
+    OutputBlockArray blocks;
+    make_output_blocks((NULL == groups) ? records.size() : groups->size(),
+            groups, blocks);
+    const int nThreads
+            = std::max(1, std::min(numThreads, (int)blocks.size()));
+    if (0 < progressInterval) {
+        stats->start_progress(progressInterval,
+                (NULL == groups) ? "records" : "groups", "blocks",
+                blocks.size());
+    }
+
+    pthread_mutex_t hdfMutex;
+    pthread_mutex_init(&hdfMutex, NULL);
+    OrderedWriter writer;
+    CoverageThreadParam *param = new CoverageThreadParam[nThreads];
     bool isError = false;
-    for (int i = 0; i < nFiles; ++i) {
-        if (!get_cover_stat(hdfs[i], start, szRegion, &coveredBases[i],
-                    minDepth, &avgDepth[i])) {
+    StageTimer timer;
+    StageCounter open;
+    if (NULL != stats)
+        timer.start();
+    for (int i = 0; i < nThreads && !isError; ++i) {
+        std::stringstream name;
+        name << "query" << i;
+        param[i].threadName = name.str();
+        param[i].records = &records;
+        param[i].groups = groups;
+        param[i].blocks = &blocks;
+        param[i].writer = &writer;
+        param[i].stats = stats;
+        param[i].query.set_hdf_mutex(&hdfMutex);
+        param[i].query.set_min_depth(minDepth);
+        param[i].query.set_inflate_threads(std::max(1, numThreads / nThreads));
+        param[i].query.set_stats(stats, param[i].threadName);
+        isError = !param[i].query.open(inputFiles);
+    }
+    if (NULL != stats) {
+        timer.stop(&open, 0, nThreads * inputFiles.size());
+        stats->add("hdf_open", "main", "", open);
+    }
+
+    if (!isError && !writer.start(&ofs, nThreads * EX_GFFC_PENDING_BLOCKS))
+        isError = true;
+    if (!isError) {
+        if (!run_ordered_blocks(blocks.size(), nThreads,
+                    determine_block_coverage, param))
             isError = true;
+        if (!writer.finish())
+            isError = true;
+        if (NULL != stats) {
+            for (int i = 0; i < nThreads; ++i) {
+                stats->add(
+                        "format", param[i].threadName, "", param[i].format);
+            }
+            stats->add("output", "writer", "", writer.get_write_counter());
         }
     }
-    if (isError) {
+
+    delete[] param;
+    pthread_mutex_destroy(&hdfMutex);
+    if (0 < progressInterval)
+        stats->stop_progress();
+    return !isError;
+}
+//------------------------------------------------------------------------------
+// A query is a GFF record or 'seqid<TAB>start<TAB>end' in the same 1-based,
+// inclusive coordinates, which is answered as a GFF record with empty fields.
+bool parse_query(const std::string &line, GffRecord &record) {
+    hi::StringArray items;
+    hi::split(items, line, '\t');
+    if (EX_GFFLIB_COL_ATTRIBUTES < items.size()) {
+        if (!record.parse(line, false))
+            return false;
+    } else if (3 == items.size()) {
+        record.seqid = items[0];
+        record.source = record.type = record.phase = EX_GFFLIB_KEY_NULL;
+        record.attributes = EX_GFFLIB_KEY_NULL;
+        record.start = std::atoi(items[1].c_str());
+        record.end = std::atoi(items[2].c_str());
+        record.score = 0;
+        record.strand = '.';
+    } else {
         return false;
     }
+    return (0 < record.start && record.start <= record.end);
+}
+//------------------------------------------------------------------------------
+bool write_all(const int fd, const std::string &data) {
+    size_t written = 0;
+    while (written < data.length()) {
+        const ssize_t n
+                = write(fd, data.c_str() + written, data.length() - written);
+        if (0 > n && EINTR == errno)
+            continue;
+        if (0 >= n)
+            return false;
+        written += n;
+    }
     return true;
 }
 //------------------------------------------------------------------------------
-bool determine_gff_coverage(HdfBaseDepthReader *hdfs, const int nFiles,
-        const GffRecordArray &records, const int minDepth, std::ostream &ofs) {
-    const char sep = '\t';
-    // common buffer
-    int *coveredBases = new int[nFiles];
-    float *avgDepth = new float[nFiles];
-
-    // process each record in GFF
-    std::string lastChrom = "";
+// answer the pending queries of a client in their order
+bool flush_queries(
+        CoverageQuery &query, GffRecordArray &records, std::ostream &ofs) {
+    if (records.empty())
+        return true;
+    CoverageRegionArray regions;
+    CoverageStatArray stats;
     for (GffRecordArray::const_iterator record = records.begin();
             record != records.end(); ++record) {
-        // new chromosome
-        if (record->seqid != lastChrom) {
-            if (!set_chromosome(hdfs, nFiles, record->seqid.c_str())) {
-                std::cerr << WARNING_STRING << "seqid (" << record->seqid
-                          << ") does not exist in HDF matrix. Skipped." << ENDL;
+        add_region(record->seqid, record->start, record->end, regions);
+    }
+    const bool isSuccess = query.query(regions, stats);
+    if (isSuccess)
+        write_record_coverage(records.data(), records.size(), stats,
+                query.get_num_samples(), true, ofs);
+    records.clear();
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+// Answer the queries of one client. Queries are taken in the blocks that
+// arrive on the socket and the rows of a block are sent back together, so a
+// client may stream any number of them. A line '#minDepth<TAB>N' changes the
+// depth threshold for the following queries; other comments are ignored.
+// The matrices stay on the last chromosome across clients.
+void serve_client(const int fd, CoverageQuery &query,
+        const hi::StringArray &sampleNames, const int defaultMinDepth) {
+    query.set_min_depth(defaultMinDepth);
+    char *buffer = new char[EX_GFFC_SERVER_BUFFER_SIZE];
+    std::string pending = "";
+    GffRecordArray records;
+
+    std::ostringstream ost;
+    write_header(sampleNames, ost);
+    bool isConnected = write_all(fd, ost.str());
+    while (isConnected) {
+        const ssize_t n = read(fd, buffer, EX_GFFC_SERVER_BUFFER_SIZE);
+        if (0 > n && EINTR == errno)
+            continue;
+        if (0 >= n) {
+            // the last query may lack a newline
+            if (pending.empty())
+                break;
+            pending += '\n';
+            isConnected = false;
+        } else {
+            pending.append(buffer, n);
+        }
+
+        ost.str("");
+        size_t lineStart = 0, lineEnd;
+        while (std::string::npos
+                != (lineEnd = pending.find('\n', lineStart))) {
+            std::string line = pending.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+            if (!line.empty() && '\r' == line[line.length() - 1])
+                line.erase(line.length() - 1);
+            if (line.empty())
+                continue;
+            if ('#' == line[0]) {
+                hi::StringArray items;
+                hi::split(items, line, '\t');
+                if (2 == items.size()
+                        && EX_GFFC_OPTION_MIN_DEPTH == items[0]) {
+                    flush_queries(query, records, ost);
+                    query.set_min_depth(
+                            std::max(0, std::atoi(items[1].c_str())));
+                }
                 continue;
             }
-            lastChrom = record->seqid;
-        }
-        const int szRegion = record->end - record->start + 1;
-        init_buffer(coveredBases, avgDepth, nFiles, 0);
-        get_cover_stat(hdfs, nFiles, &(record->start), &szRegion, coveredBases,
-                minDepth, avgDepth);
-        // write results
-        ofs << *record;
-        for (int i = 0; i < nFiles; ++i) {
-            ofs << sep << avgDepth[i] << sep << coveredBases[i] << sep
-                << (float)coveredBases[i] / (float)szRegion;
+            GffRecord record;
+            if (!parse_query(line, record)) {
+                flush_queries(query, records, ost);
+                ost << "#invalid\t" << line << ENDL;
+                continue;
+            }
+            records.push_back(record);
         }
-        ofs << ENDL;
+        pending.erase(0, lineStart);
+        flush_queries(query, records, ost);
+        if (!write_all(fd, ost.str()))
+            break;
     }
-    delete[] coveredBases;
-    delete[] avgDepth;
-    return true;
+    delete[] buffer;
+    return;
+}
+//------------------------------------------------------------------------------
+volatile sig_atomic_t isServerStopped = 0;
+void stop_server(int signum) {
+    isServerStopped = 1;
 }
 //------------------------------------------------------------------------------
-bool read_gff_from_file(const char *gffFn, GffRecordArray &records) {
-    std::ifstream infile(gffFn, std::ios::in);
-    if (infile.fail()) {
-        std::cerr << ERROR_STRING << "failed to open the input GFF (" << gffFn
-                  << "). Aborted. [code: " << __LINE__ << "]" << ENDL;
+// Keep the matrices open and answer clients on a Unix domain socket one after
+// another until SIGINT or SIGTERM. HDF5 is used from this thread only.
+bool run_server(const std::string &socketFn, CoverageQuery &query,
+        const hi::StringArray &sampleNames, const int minDepth) {
+    struct sockaddr_un address;
+    if (sizeof(address.sun_path) <= socketFn.length()) {
+        std::cerr << ERROR_STRING << "the socket path (" << socketFn
+                  << ") is too long." << ENDL;
         return false;
     }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketFn.c_str());
 
-    std::string line;
-    while (std::getline(infile, line)) {
-        if ('#' == line[0] || line.empty()) {
-            continue;
+    // a socket left by a previous server is replaced
+    struct stat info;
+    if (0 == lstat(socketFn.c_str(), &info) && S_ISSOCK(info.st_mode))
+        unlink(socketFn.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > listener
+            || 0 > bind(listener, (struct sockaddr *)&address,
+                       sizeof(address))
+            || 0 > listen(listener, EX_GFFC_SERVER_BACKLOG)) {
+        std::cerr << ERROR_STRING << "can't listen on " << socketFn << " ("
+                  << std::strerror(errno) << ")." << ENDL;
+        return false;
+    }
+
+    // accept() is interrupted by the signals to stop the server
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << INFO_STRING << "serving " << query.get_num_samples()
+              << " matrix(es) on "
+              << socketFn << ENDL;
+    long nClients = 0;
+    while (!isServerStopped) {
+        const int fd = accept(listener, NULL, NULL);
+        if (0 > fd) {
+            if (EINTR == errno)
+                continue;
+            std::cerr << ERROR_STRING << "accept() failed ("
+                      << std::strerror(errno) << ")." << ENDL;
+            break;
         }
-        GffRecord gff(line, false);
-        records.push_back(gff);
+        serve_client(fd, query, sampleNames, minDepth);
+        close(fd);
+        ++nClients;
     }
-    infile.close();
+    close(listener);
+    unlink(socketFn.c_str());
+    std::cerr << INFO_STRING << "server stopped after " << nClients
+              << " client(s)." << ENDL;
     return true;
 }
 //------------------------------------------------------------------------------
@@ -152,16 +582,39 @@ void print_usage(const char *cmd) {
     std::cerr << "Available options:" << ENDL;
     std::cerr << " -i  input GFF filename [MANDATORY]" << ENDL;
     std::cerr << " -m  min read depth to consider 'covered' ["
-              << EX_GFFC_MIN_DEPTH << "]" << ENDL << ENDL;
+              << EX_GFFC_MIN_DEPTH << "]" << ENDL;
+    std::cerr << " -g  aggregate records sharing this attribute (e.g. Parent, "
+                 "gene_id) over the union of their intervals"
+              << ENDL;
+    std::cerr << " -T  use only records of this type (e.g. exon) [all]" << ENDL;
+    std::cerr << " -t  number of threads [" << EX_GFFC_NUM_THREADS << "]"
+              << ENDL;
+    std::cerr << " -S  serve queries on this Unix domain socket instead of "
+                 "reading -i (see coverage_client)"
+              << ENDL;
+    std::cerr << " --stats file.json  write wall/CPU time, bytes and records "
+                 "per stage, thread and chromosome"
+              << ENDL;
+    std::cerr << " --progress[=sec]   print the progress to stderr "
+                 "periodically ["
+              << EX_STATS_PROGRESS_INTERVAL << "]" << ENDL << ENDL;
     return;
 }
 //------------------------------------------------------------------------------
 int main(int argc, char **argv) {
-    std::string gffFn = "";
-    int minDepth = EX_GFFC_MIN_DEPTH;
+    std::string gffFn = "", groupKey = "", featureType = "", socketFn = "",
+                statsFn = "";
+    int minDepth = EX_GFFC_MIN_DEPTH, numThreads = EX_GFFC_NUM_THREADS;
+    double progressInterval = 0;
     // parse arguments
-    char option;
-    while ((option = getopt(argc, argv, "i:m:h")) != -1) {
+    int option;
+    static struct option longOptions[] = {
+            {"stats", required_argument, NULL, EX_GFFC_OPTION_STATS},
+            {"progress", optional_argument, NULL, EX_GFFC_OPTION_PROGRESS},
+            {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(
+                    argc, argv, "i:m:g:T:S:t:h", longOptions, NULL))
+            != -1) {
         switch (option) {
             case 'i':
                 gffFn = optarg;
@@ -176,6 +629,35 @@ int main(int argc, char **argv) {
                     minDepth = EX_GFFC_MIN_DEPTH;
                 }
                 break;
+            case 'g':
+                groupKey = optarg;
+                break;
+            case 'T':
+                featureType = optarg;
+                break;
+            case 'S':
+                socketFn = optarg;
+                break;
+            case 't':
+                numThreads = std::atoi(optarg);
+                if (0 >= numThreads) {
+                    std::cerr << WARNING_STRING
+                              << "number of threads must be a positive "
+                                 "integer. Using a default setting (-t "
+                              << EX_GFFC_NUM_THREADS << ")." << ENDL;
+                    numThreads = EX_GFFC_NUM_THREADS;
+                }
+                break;
+            case EX_GFFC_OPTION_STATS:
+                statsFn = optarg;
+                break;
+            case EX_GFFC_OPTION_PROGRESS:
+                progressInterval = (NULL == optarg)
+                        ? EX_STATS_PROGRESS_INTERVAL
+                        : std::atof(optarg);
+                if (0 >= progressInterval)
+                    progressInterval = EX_STATS_PROGRESS_INTERVAL;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 exit(EXIT_SUCCESS);
@@ -188,7 +670,7 @@ int main(int argc, char **argv) {
     }
 
     // check mandatory arguments
-    if (gffFn.empty()) {
+    if (gffFn.empty() && socketFn.empty()) {
         std::cerr << ERROR_STRING << "an input GFF (-i) is mandatory." << ENDL
                   << ENDL;
         print_usage(argv[0]);
@@ -204,39 +686,89 @@ int main(int argc, char **argv) {
         sampleNames.push_back(inputFn);
     }
 
+    // stage counters, measured only when they are reported
+    StageStats stageStats;
+    StageStats *stats
+            = (statsFn.empty() && 0 >= progressInterval) ? NULL : &stageStats;
+
+    // server mode: records come from clients
+    if (!socketFn.empty()) {
+        CoverageQuery query;
+        query.set_stats(stats, "server");
+        if (!query.open(inputFiles)) {
+            exit(EXIT_FAILURE);
+        }
+        query.set_min_depth(minDepth);
+        query.set_inflate_threads(numThreads);
+        if (!gffFn.empty() || !groupKey.empty() || !featureType.empty()) {
+            std::cerr << WARNING_STRING << "-i, -g and -T are ignored in the "
+                      << "server mode." << ENDL;
+        }
+        bool isSuccess = run_server(socketFn, query, sampleNames, minDepth);
+        query.close();
+        if (!statsFn.empty() && !stageStats.write_json(statsFn, "gff_coverage"))
+            isSuccess = false;
+        exit(isSuccess ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     // read feature coordinates from GFF
     GffRecordArray records;
+    StageTimer timer;
+    StageCounter parse;
+    if (NULL != stats)
+        timer.start();
     if (!read_gff_from_file(gffFn.c_str(), records)) {
         exit(EXIT_FAILURE);
     }
-
-    // input HDFs
-    HdfBaseDepthReader *hdfs = new HdfBaseDepthReader[inputFiles.size()];
-    if (!open_hdfs(inputFiles, hdfs)) {
-        exit(EXIT_FAILURE);
+    if (NULL != stats) {
+        struct stat gffStat;
+        const long bytes
+                = (0 == stat(gffFn.c_str(), &gffStat)) ? gffStat.st_size : 0;
+        timer.stop(&parse, bytes, records.size());
+        stats->add("gff_parse", "main", "", parse);
     }
 
-    // write header
-    std::cout << "#CHROM\tsource\ttype\tstart\tend\tscore\tstrand\tphase\tattri"
-                 "butes";
-    for (hi::StringArray::const_iterator name = sampleNames.begin();
-            name != sampleNames.end(); ++name) {
-        std::cout << '\t' << *name << ".avgDepth\t" << *name
-                  << ".coveredBases\t" << *name << ".coveredFrac";
-    }
-    std::cout << ENDL;
+    // aggregated mode: one row per attribute value over the interval union
+    if (!groupKey.empty()) {
+        FeatureGroupArray groups;
+        make_feature_groups(records, groupKey, featureType, groups);
 
-    // process matrices
-    if (!determine_gff_coverage(
-                hdfs, inputFiles.size(), records, minDepth, std::cout)) {
-        exit(EXIT_FAILURE);
-    }
+        std::cout << "#CHROM\tstart\tend\tstrand\t" << groupKey
+                  << "\tnIntervals\tunionLength";
+        for (hi::StringArray::const_iterator name = sampleNames.begin();
+                name != sampleNames.end(); ++name) {
+            std::cout << '\t' << *name << ".avgDepth\t" << *name
+                      << ".coveredBases\t" << *name << ".coveredFrac";
+        }
+        std::cout << ENDL;
 
-    // clean-up
-    for (size_t i = 0; i < inputFiles.size(); ++i) {
-        hdfs[i].close();
+        if (!determine_coverage(inputFiles, minDepth, numThreads, records,
+                    &groups, std::cout, stats, progressInterval)) {
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        if (!featureType.empty()) {
+            GffRecordArray selected;
+            for (GffRecordArray::const_iterator record = records.begin();
+                    record != records.end(); ++record) {
+                if (featureType == record->type)
+                    selected.push_back(*record);
+            }
+            records.swap(selected);
+        }
+
+        // write header
+        write_header(sampleNames, std::cout);
+
+        // process matrices
+        if (!determine_coverage(inputFiles, minDepth, numThreads, records,
+                    NULL, std::cout, stats, progressInterval)) {
+            exit(EXIT_FAILURE);
+        }
     }
-    delete[] hdfs;
+
+    if (!statsFn.empty() && !stageStats.write_json(statsFn, "gff_coverage"))
+        exit(EXIT_FAILURE);
     exit(EXIT_SUCCESS);
 }
 //------------------------------------------------------------------------------
@@ -0,0 +1,353 @@
+#include "histd.h"
+
+#include "alignment_filter.h"
+#include "gfflib.h"
+
+#include <algorithm>
+#include <api/BamReader.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define EX_GFFRC_NUM_THREADS 8
+//------------------------------------------------------------------------------
+// features of one chromosome, sorted by start position
+struct ChromFeatures {
+    std::string seqid;
+    std::vector<int> index;  // indices into the GFF record array
+    int minStart, maxEnd;
+};
+typedef std::vector<ChromFeatures> ChromFeaturesArray;
+//------------------------------------------------------------------------------
+struct AssignStat {
+    long assigned, ambiguous, noFeature;
+};
+//------------------------------------------------------------------------------
+class FeatureStartLess {
+public:
+    explicit FeatureStartLess(const GffRecordArray &r) : records(r) {}
+    bool operator()(const int left, const int right) const {
+        if (records[left].start != records[right].start)
+            return records[left].start < records[right].start;
+        return left < right;
+    }
+
+private:
+    const GffRecordArray &records;
+};
+//------------------------------------------------------------------------------
+void make_chrom_features(const GffRecordArray &records,
+        const std::string &featureType, ChromFeaturesArray &chroms) {
+    std::map<std::string, int> chromIndex;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (!featureType.empty() && featureType != records[i].type)
+            continue;
+        std::map<std::string, int>::iterator hit
+                = chromIndex.find(records[i].seqid);
+        if (chromIndex.end() == hit) {
+            ChromFeatures chrom;
+            chrom.seqid = records[i].seqid;
+            chrom.minStart = records[i].start;
+            chrom.maxEnd = records[i].end;
+            hit = chromIndex
+                          .insert(std::pair<std::string, int>(
+                                  records[i].seqid, chroms.size()))
+                          .first;
+            chroms.push_back(chrom);
+        }
+        ChromFeatures &chrom = chroms[hit->second];
+        chrom.index.push_back(i);
+        chrom.minStart = std::min(chrom.minStart, records[i].start);
+        chrom.maxEnd = std::max(chrom.maxEnd, records[i].end);
+    }
+    for (ChromFeaturesArray::iterator chrom = chroms.begin();
+            chrom != chroms.end(); ++chrom) {
+        std::sort(chrom->index.begin(), chrom->index.end(),
+                FeatureStartLess(records));
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+// Aligned blocks of an alignment as 1-based inclusive intervals. M, = and X
+// cover reference bases while D and N only skip them, so the introns of a
+// spliced read are not part of it. Returns the 0-based end of the alignment,
+// as GetEndPosition() does.
+int get_aligned_blocks(const BamTools::BamAlignment &alignment,
+        std::vector<int> &blockStart, std::vector<int> &blockEnd) {
+    blockStart.clear();
+    blockEnd.clear();
+    int position = alignment.Position;
+    for (std::vector<BamTools::CigarOp>::const_iterator op
+            = alignment.CigarData.begin();
+            op != alignment.CigarData.end(); ++op) {
+        switch (op->Type) {
+            case 'M':
+            case '=':
+            case 'X':
+                if (!blockEnd.empty() && position == blockEnd.back()) {
+                    blockEnd.back() += op->Length;
+                } else {
+                    blockStart.push_back(position + 1);
+                    blockEnd.push_back(position + op->Length);
+                }
+                position += op->Length;
+                break;
+            case 'D':
+            case 'N':
+                position += op->Length;
+                break;
+            default:
+                break;
+        }
+    }
+    return position;
+}
+//------------------------------------------------------------------------------
+bool is_block_overlapped(const GffRecord &feature,
+        const std::vector<int> &blockStart, const std::vector<int> &blockEnd) {
+    for (size_t b = 0; b < blockStart.size(); ++b) {
+        if (feature.start <= blockEnd[b] && blockStart[b] <= feature.end)
+            return true;
+    }
+    return false;
+}
+//------------------------------------------------------------------------------
+// Sweep position-sorted alignments of one chromosome against its sorted
+// features. Features enter the active set once an alignment reaches their
+// start and leave it when alignments have passed their end, so each alignment
+// is compared only with the features it may overlap.
+bool count_chromosome(const std::string &bamFn, const ChromFeatures &chrom,
+        const GffRecordArray &records, const AlignmentFilter &filter,
+        const bool isUniqueOnly, const int sampleIndex, const int nSamples,
+        int *counts, AssignStat *stat) {
+    BamTools::BamReader bam_reader;
+    if (!bam_reader.Open(bamFn)) {
+        std::cerr << ERROR_STRING << "bam_reader.Open() failed at line "
+                  << __LINE__ << ". input_fn=" << bamFn << ENDL;
+        return false;
+    }
+    // without an index, each chromosome would read the whole BAM
+    if (!bam_reader.LocateIndex(BamTools::BamIndex::STANDARD)
+            && !bam_reader.CreateIndex(BamTools::BamIndex::STANDARD)) {
+        std::cerr << ERROR_STRING << "can't find or create the index of "
+                  << bamFn << "." << ENDL;
+        bam_reader.Close();
+        return false;
+    }
+
+    const int refid = bam_reader.GetReferenceID(chrom.seqid);
+    if (0 > refid) {
+        std::cerr << WARNING_STRING << "seqid (" << chrom.seqid
+                  << ") does not exist in " << bamFn << ". Skipped." << ENDL;
+        bam_reader.Close();
+        return true;
+    }
+    // GFF is 1-based inclusive; BAM regions are 0-based half-open
+    if (!bam_reader.SetRegion(
+                refid, chrom.minStart - 1, refid, chrom.maxEnd)) {
+        std::cerr << ERROR_STRING << "can't set the region of seqid ("
+                  << chrom.seqid << ") in " << bamFn << "." << ENDL;
+        bam_reader.Close();
+        return false;
+    }
+
+    const int nFeatures = chrom.index.size();
+    std::vector<int> active, hits, blockStart, blockEnd;
+    int next = 0;
+    BamTools::BamAlignment alignment;
+    while (bam_reader.GetNextAlignmentCore(alignment)) {
+        if (refid != alignment.RefID || !alignment.IsMapped()
+                || !alignment.IsPrimaryAlignment()
+                || !filter.is_passed(alignment))
+            continue;
+        // 1-based inclusive span of the alignment; features are matched
+        // against its aligned blocks, or the first base if it has none
+        const int alignmentStart = alignment.Position + 1;
+        const int alignmentEnd = std::max(alignmentStart,
+                get_aligned_blocks(alignment, blockStart, blockEnd));
+        if (blockStart.empty()) {
+            blockStart.push_back(alignmentStart);
+            blockEnd.push_back(alignmentEnd);
+        }
+
+        while (next < nFeatures
+                && records[chrom.index[next]].start <= alignmentEnd) {
+            active.push_back(chrom.index[next]);
+            ++next;
+        }
+        // alignments are sorted by start, so features ending before this one
+        // can not overlap any later alignment
+        for (size_t i = 0; i < active.size();) {
+            if (records[active[i]].end < alignmentStart) {
+                active[i] = active.back();
+                active.pop_back();
+            } else {
+                ++i;
+            }
+        }
+
+        hits.clear();
+        for (std::vector<int>::const_iterator f = active.begin();
+                f != active.end(); ++f) {
+            if (is_block_overlapped(records[*f], blockStart, blockEnd))
+                hits.push_back(*f);
+        }
+
+        if (hits.empty()) {
+            ++(stat->noFeature);
+        } else if (1 < hits.size() && isUniqueOnly) {
+            ++(stat->ambiguous);
+        } else {
+            ++(stat->assigned);
+            for (std::vector<int>::const_iterator f = hits.begin();
+                    f != hits.end(); ++f)
+                ++counts[(size_t)*f * nSamples + sampleIndex];
+        }
+    }
+
+    bam_reader.Close();
+    return true;
+}
+//------------------------------------------------------------------------------
+void print_usage(const char *cmd) {
+    std::cerr << USAGE_STRING << cmd << " (options) bam1 bam2..." << ENDL;
+    std::cerr << "Available options:" << ENDL;
+    std::cerr << " -i  input GFF filename [MANDATORY]" << ENDL;
+    std::cerr << " -t  number of threads [" << EX_GFFRC_NUM_THREADS << "]"
+              << ENDL;
+    std::cerr << " -T  count only features of this type (e.g. gene) [all]"
+              << ENDL;
+    std::cerr << " -f  alignment filter, comma-separated mapq=N, strand=+|-, "
+                 "nodup, nosupp, noqcfail, proper, f=INT, F=INT"
+              << ENDL;
+    std::cerr << " -u  skip alignments overlapping more than one feature "
+                 "instead of counting them for each"
+              << ENDL << ENDL;
+    std::cerr << "Mapped primary alignments are counted for the features "
+                 "overlapping their aligned (M, =, X) blocks, so introns (N) "
+                 "and deletions (D) do not count. Input BAMs must be sorted "
+                 "by position and indexed."
+              << ENDL << ENDL;
+    return;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    std::string gffFn = "", featureType = "";
+    int numThreads = EX_GFFRC_NUM_THREADS;
+    bool isUniqueOnly = false;
+    AlignmentFilter filter;
+    // parse arguments
+    char option;
+    while ((option = getopt(argc, argv, "i:t:T:f:uh")) != -1) {
+        switch (option) {
+            case 'i':
+                gffFn = optarg;
+                break;
+            case 't':
+                numThreads = std::max(1, std::atoi(optarg));
+                break;
+            case 'T':
+                featureType = optarg;
+                break;
+            case 'f':
+                if (!filter.parse(std::string("count:") + optarg))
+                    exit(EXIT_FAILURE);
+                break;
+            case 'u':
+                isUniqueOnly = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                std::cerr << WARNING_STRING
+                          << "unknown option specified and ignored." << ENDL;
+                break;
+        }
+    }
+
+    // check mandatory arguments
+    if (gffFn.empty() || optind >= argc) {
+        std::cerr << ERROR_STRING
+                  << "an input GFF (-i) and at least one BAM are mandatory."
+                  << ENDL << ENDL;
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    hi::StringArray inputFiles;
+    for (int i = optind; i < argc; ++i) {
+        inputFiles.push_back(argv[i]);
+    }
+    const int nSamples = inputFiles.size();
+
+    // read feature coordinates from GFF
+    GffRecordArray records;
+    if (!read_gff_from_file(gffFn.c_str(), records)) {
+        exit(EXIT_FAILURE);
+    }
+    ChromFeaturesArray chroms;
+    make_chrom_features(records, featureType, chroms);
+
+    // one task per (chromosome, sample); every task writes its own cells
+    int *counts = new int[records.size() * nSamples];
+    std::fill(counts, counts + records.size() * nSamples, 0);
+    AssignStat *stats = new AssignStat[chroms.size() * nSamples];
+    const int nTasks = chroms.size() * nSamples;
+    bool isError = false;
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+    for (int task = 0; task < nTasks; ++task) {
+        const int chromIndex = task / nSamples;
+        const int sampleIndex = task % nSamples;
+        AssignStat &stat = stats[task];
+        stat.assigned = stat.ambiguous = stat.noFeature = 0;
+        if (!count_chromosome(inputFiles[sampleIndex], chroms[chromIndex],
+                    records, filter, isUniqueOnly, sampleIndex, nSamples,
+                    counts, &stat)) {
+#pragma omp critical
+            isError = true;
+        }
+    }
+    if (isError) {
+        exit(EXIT_FAILURE);
+    }
+
+    // summary
+    for (int i = 0; i < nSamples; ++i) {
+        AssignStat total = {0, 0, 0};
+        for (size_t c = 0; c < chroms.size(); ++c) {
+            total.assigned += stats[c * nSamples + i].assigned;
+            total.ambiguous += stats[c * nSamples + i].ambiguous;
+            total.noFeature += stats[c * nSamples + i].noFeature;
+        }
+        std::cerr << INFO_STRING << inputFiles[i]
+                  << ": assigned=" << total.assigned
+                  << ", ambiguous=" << total.ambiguous
+                  << ", noFeature=" << total.noFeature << ENDL;
+    }
+
+    // write the feature x sample matrix in the GFF order
+    std::cout << "#CHROM\tsource\ttype\tstart\tend\tscore\tstrand\tphase\tattri"
+                 "butes";
+    for (hi::StringArray::const_iterator name = inputFiles.begin();
+            name != inputFiles.end(); ++name) {
+        std::cout << '\t' << *name << ".readCount";
+    }
+    std::cout << ENDL;
+    for (size_t f = 0; f < records.size(); ++f) {
+        if (!featureType.empty() && featureType != records[f].type)
+            continue;
+        std::cout << records[f];
+        for (int i = 0; i < nSamples; ++i) {
+            std::cout << '\t' << counts[f * nSamples + i];
+        }
+        std::cout << ENDL;
+    }
+
+    delete[] counts;
+    delete[] stats;
+    exit(EXIT_SUCCESS);
+}
+//------------------------------------------------------------------------------
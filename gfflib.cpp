@@ -151,3 +151,23 @@ bool remove_attribute_item(std::string &line, const std::string &key) {
     return true;
 }
 //------------------------------------------------------------------------------
+bool read_gff_from_file(const char *gffFn, GffRecordArray &records) {
+    std::ifstream infile(gffFn, std::ios::in);
+    if (infile.fail()) {
+        std::cerr << ERROR_STRING << "failed to open the input GFF (" << gffFn
+                  << "). Aborted. [code: " << __LINE__ << "]" << ENDL;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+        if ('#' == line[0] || line.empty()) {
+            continue;
+        }
+        GffRecord gff(line, false);
+        records.push_back(gff);
+    }
+    infile.close();
+    return true;
+}
+//------------------------------------------------------------------------------
@@ -66,5 +66,6 @@ bool get_attribute_item(
 bool replace_attribute_item(
         std::string &line, const std::string &key, const std::string &value);
 bool remove_attribute_item(std::string &line, const std::string &key);
+bool read_gff_from_file(const char *gffFn, GffRecordArray &records);
 //------------------------------------------------------------------------------
 #endif
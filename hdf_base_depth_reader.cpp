@@ -1,11 +1,14 @@
 #include "hdf_base_depth_reader.h"
 
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+#include <zlib.h>
+
 //------------------------------------------------------------------------------
 bool HdfBaseDepthReader::open(const char *filename) {
-    if (isFileOpened) {
-        delete[] hdfFile;
-        isFileOpened = false;
-    }
+    if (isFileOpened)
+        close();
 
     try {
         H5::Exception::dontPrint();
@@ -22,77 +25,562 @@ bool HdfBaseDepthReader::open(const char *filename) {
 //------------------------------------------------------------------------------
 bool HdfBaseDepthReader::set_target_chromosome(const char *chr_str) {
     if (chr_str != currentChrName) {
-        if (isGroupAllocated) {
-            delete hdfGroup;
-            isGroupAllocated = false;
+        // the group object is kept and only its handle replaced
+        if (!isGroupAllocated) {
+            hdfGroup = new H5::Group;
+            isGroupAllocated = true;
         }
 
         try {
             H5::Exception::dontPrint();
-            hdfGroup = new H5::Group(hdfFile->openGroup(chr_str));
-            isGroupAllocated = true;
-        } catch (H5::GroupIException err) {
+            *hdfGroup = hdfFile->openGroup(chr_str);
+        } catch (H5::Exception err) {
             std::cerr << ERROR_STRING << "a replicon '" << chr_str
                       << "' can't open." << ENDL;
+            currentChrName = "";
             return false;
         }
         currentChrName = chr_str;
+        if (!load_regions()) {
+            currentChrName = "";
+            return false;
+        }
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// target intervals -- Added in the matrix Version 0.5
+bool HdfBaseDepthReader::load_regions(void) {
+    isRestricted = false;
+    regionStart.clear();
+    regionEnd.clear();
+    regionOffset.clear();
+    if (0 >= H5Lexists(hdfGroup->getId(), EX_HDFBDR_REGION_START, H5P_DEFAULT))
+        return true;
+
+    try {
+        H5::Exception::dontPrint();
+        H5::DataSet length = hdfGroup->openDataSet("Length");
+        length.read(&chromLength, H5::PredType::NATIVE_INT);
+
+        const char *names[] = {EX_HDFBDR_REGION_START, EX_HDFBDR_REGION_END,
+                EX_HDFBDR_REGION_OFFSET};
+        std::vector<int> *arrays[] = {&regionStart, &regionEnd, &regionOffset};
+        for (int i = 0; i < 3; ++i) {
+            H5::DataSet dataset = hdfGroup->openDataSet(names[i]);
+            arrays[i]->resize(dataset.getSpace().getSimpleExtentNpoints());
+            if (!arrays[i]->empty())
+                dataset.read(arrays[i]->data(), H5::PredType::NATIVE_INT);
+        }
+    } catch (H5::Exception err) {
+        std::cerr << ERROR_STRING << "can't read the target regions of '"
+                  << currentChrName << "'." << ENDL;
+        return false;
     }
+    isRestricted = true;
     return true;
 }
 //------------------------------------------------------------------------------
 bool HdfBaseDepthReader::set_target_dataset(
         const char *dataName, const H5::DataType dataType) {
-    if (isDataSetAllocated) {
-        delete hdfDataSet;
-        isDataSetAllocated = false;
+    isDataSetAllocated = false;
+    isDataSpaceAllocated = false;
+    isSparse = false;
+    isRawChunked = false;
+    currentHandle = NULL;
+    if (!isGroupAllocated || currentChrName.empty())
+        return false;
+
+    DataSetHandle *handle = find_handle(dataName);
+    if (NULL == handle && NULL == (handle = open_handle(dataName)))
+        return false;
+    handle->lastUse = ++handleClock;
+    currentHandle = handle;
+    currentDataName = dataName;
+    currentDataType = dataType;
+    if (handle->isSparse) {
+        isSparse = true;
+        isRunLength = handle->isRunLength;
+        sparseLength = handle->sparseLength;
+        return true;
+    }
+
+    hdfDataSet = &handle->dataSet;
+    hdfDataSpace = &handle->dataSpace;
+    isDataSetAllocated = true;
+    isDataSpaceAllocated = true;
+    // raw chunks are decoded into int32 only
+    isRawChunked = handle->isRawChunked
+            && 0 < H5Tequal(dataType.getId(), H5T_NATIVE_INT32);
+    isDeflated = handle->isDeflated;
+    chunkSize = handle->chunkSize;
+    datasetLength = handle->datasetLength;
+    fillValue = handle->fillValue;
+    return true;
+}
+//------------------------------------------------------------------------------
+HdfBaseDepthReader::DataSetHandle *HdfBaseDepthReader::find_handle(
+        const char *dataName) {
+    for (size_t i = 0; i < handles.size(); ++i) {
+        if (handles[i]->isOpen && handles[i]->chrom == currentChrName
+                && handles[i]->name == dataName)
+            return handles[i];
     }
-    if (isDataSpaceAllocated) {
-        delete hdfDataSpace;
-        isDataSpaceAllocated = false;
+    return NULL;
+}
+//------------------------------------------------------------------------------
+// A dataset of the current chromosome opened in a new handle, or in the least
+// recently used one when the cache is full.
+HdfBaseDepthReader::DataSetHandle *HdfBaseDepthReader::open_handle(
+        const char *dataName) {
+    DataSetHandle *handle;
+    if (EX_HDFBDR_HANDLE_CACHE_SIZE > handles.size()) {
+        handle = new DataSetHandle;
+        handles.push_back(handle);
+    } else {
+        handle = handles[0];
+        for (size_t i = 1; i < handles.size(); ++i) {
+            if (handles[i]->lastUse < handle->lastUse)
+                handle = handles[i];
+        }
     }
+    handle->isOpen = false;
+    handle->lastUse = 0;
+    handle->dataSet.close();
+    handle->dataSpace.close();
 
-    try {
-        hdfDataSet = new H5::DataSet(hdfGroup->openDataSet(dataName));
-        isDataSetAllocated = true;
-        hdfDataSpace = new H5::DataSpace(hdfDataSet->getSpace());
-        isDataSpaceAllocated = true;
-    } catch (H5::GroupIException err) {
-        std::cerr << ERROR_STRING << "can't find the specified dataset '"
-                  << dataName << "' in the group." << ENDL;
+    // sparse tracks are stored as groups -- Added in the matrix Version 0.4
+    const hid_t object = H5Oopen(hdfGroup->getId(), dataName, H5P_DEFAULT);
+    const bool isGroup = (0 <= object && H5I_GROUP == H5Iget_type(object));
+    if (0 <= object)
+        H5Oclose(object);
+    if (isGroup) {
+        if (!load_sparse(handle, dataName))
+            return NULL;
+    } else {
+        try {
+            handle->dataSet = hdfGroup->openDataSet(dataName);
+            handle->dataSpace = handle->dataSet.getSpace();
+        } catch (H5::GroupIException err) {
+            std::cerr << ERROR_STRING << "can't find the specified dataset '"
+                      << dataName << "' in the group." << ENDL;
+            return NULL;
+        } catch (H5::DataSetIException err) {
+            std::cerr << ERROR_STRING << "can't find a specified dataset '"
+                      << dataName << "'." << ENDL;
+            return NULL;
+        } catch (H5::DataSpaceIException err) {
+            std::cerr << ERROR_STRING << "can't create a dataspace." << ENDL;
+            return NULL;
+        }
+        handle->isSparse = false;
+        std::vector<int>().swap(handle->sparsePosition);
+        std::vector<IntType>().swap(handle->sparseValue);
+        check_raw_chunks(handle);
+    }
+    handle->chrom = currentChrName;
+    handle->name = dataName;
+    handle->isOpen = true;
+    return handle;
+}
+//------------------------------------------------------------------------------
+void HdfBaseDepthReader::clear_handles(void) {
+    for (size_t i = 0; i < handles.size(); ++i)
+        delete handles[i];
+    handles.clear();
+    currentHandle = NULL;
+    isDataSetAllocated = false;
+    isDataSpaceAllocated = false;
+}
+//------------------------------------------------------------------------------
+// Raw chunks are read only when they can be decoded here: int32 values in
+// 1-D chunks with no filter or deflate alone. Virtual datasets (-P) and
+// other filters are read by HDF5.
+void HdfBaseDepthReader::check_raw_chunks(DataSetHandle *handle) {
+    handle->isRawChunked = false;
+    const hid_t dcpl = H5Dget_create_plist(handle->dataSet.getId());
+    const hid_t fileType = H5Dget_type(handle->dataSet.getId());
+    hsize_t dims[1];
+    bool isSupported = 0 <= dcpl && 0 <= fileType
+            && H5D_CHUNKED == H5Pget_layout(dcpl)
+            && 1 == H5Pget_chunk(dcpl, 1, dims)
+            && 0 < H5Tequal(fileType, H5T_NATIVE_INT32);
+    const int nFilters = isSupported ? H5Pget_nfilters(dcpl) : -1;
+    handle->isDeflated = (1 == nFilters);
+    if (handle->isDeflated) {
+        unsigned int flags;
+        size_t nValues = 0;
+        isSupported = (H5Z_FILTER_DEFLATE
+                == H5Pget_filter2(
+                        dcpl, 0, &flags, &nValues, NULL, 0, NULL, NULL));
+    } else if (0 != nFilters) {
+        isSupported = false;
+    }
+    handle->fillValue = 0;
+    if (isSupported)
+        isSupported = (0 <= H5Pget_fill_value(
+                               dcpl, H5T_NATIVE_INT32, &handle->fillValue));
+    if (0 <= fileType)
+        H5Tclose(fileType);
+    if (0 <= dcpl)
+        H5Pclose(dcpl);
+    if (!isSupported)
+        return;
+
+    handle->chunkSize = dims[0];
+    hsize_t length[1];
+    if (1 != handle->dataSpace.getSimpleExtentDims(length, NULL))
+        return;
+    handle->datasetLength = length[0];
+    handle->isRawChunked = true;
+}
+//------------------------------------------------------------------------------
+// Chunks overlapping [start, start + count) of the current dataset, as
+// stored. Coordinates are those of the dataset, i.e. compact offsets for a
+// restricted matrix (see can_read_raw_chunks()).
+bool HdfBaseDepthReader::read_raw_chunks(
+        const int *start, const int *count, RawChunkSet &chunks) {
+    if (!isFileOpened || !isRawChunked || isSparse)
         return false;
-    } catch (H5::DataSetIException err) {
-        std::cerr << ERROR_STRING << "can't find a specified dataset '"
+    if (0 > *start || 0 > *count || datasetLength < *start + *count) {
+        std::cerr << ERROR_STRING << "can't read data from a dataspace."
+                  << " start=" << *start << ", count=" << *count << ENDL;
+        return false;
+    }
+
+    chunks.start = *start;
+    chunks.count = *count;
+    chunks.chunkSize = chunkSize;
+    chunks.isDeflated = isDeflated;
+    chunks.fillValue = fillValue;
+    chunks.firstChunk = *start / chunkSize;
+    chunks.numChunks = (0 < *count)
+            ? (*start + *count - 1) / chunkSize - chunks.firstChunk + 1
+            : 0;
+    if ((int)chunks.data.size() < chunks.numChunks) {
+        chunks.data.resize(chunks.numChunks);
+        chunks.filterMask.resize(chunks.numChunks);
+    }
+
+    const hid_t dataset = hdfDataSet->getId();
+    for (int k = 0; k < chunks.numChunks; ++k) {
+        hsize_t offset[1], szRaw = 0;
+        offset[0] = (hsize_t)(chunks.firstChunk + k) * chunkSize;
+        chunks.filterMask[k] = 0;
+        if (0 > H5Dget_chunk_storage_size(dataset, offset, &szRaw)) {
+            szRaw = 0;  // never written; read as the fill value
+        }
+        chunks.data[k].resize(szRaw);
+        if (0 < szRaw
+                && 0 > H5Dread_chunk(dataset, H5P_DEFAULT, offset,
+                               &chunks.filterMask[k], chunks.data[k].data())) {
+            std::cerr << ERROR_STRING << "can't read a chunk at " << offset[0]
+                      << " of '" << currentDataName << "'." << ENDL;
+            return false;
+        }
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// one chunk into its part of 'buffer'; chunks not wholly in the region are
+// decoded into 'scratch' first
+bool inflate_chunk(const RawChunkSet &chunks, const int k, IntType *buffer,
+        std::vector<IntType> &scratch) {
+    const int chunkStart = (chunks.firstChunk + k) * chunks.chunkSize;
+    const int from = std::max(chunks.start, chunkStart);
+    const int to = std::min(
+            chunks.start + chunks.count, chunkStart + chunks.chunkSize);
+    IntType *target = buffer + (from - chunks.start);
+    const std::vector<unsigned char> &raw = chunks.data[k];
+    if (raw.empty()) {
+        std::fill(target, target + (to - from), chunks.fillValue);
+        return true;
+    }
+
+    const bool isWhole
+            = (from == chunkStart && to == chunkStart + chunks.chunkSize);
+    IntType *chunk = target;
+    if (!isWhole) {
+        if (scratch.size() < (size_t)chunks.chunkSize)
+            scratch.resize(chunks.chunkSize);
+        chunk = scratch.data();
+    }
+    // edge chunks are stored at the full chunk size
+    const uLongf szChunk = (uLongf)chunks.chunkSize * sizeof(IntType);
+    if (chunks.isDeflated && 0 == (chunks.filterMask[k] & 1)) {
+        uLongf szInflated = szChunk;
+        if (Z_OK != uncompress((Bytef *)chunk, &szInflated, raw.data(),
+                            raw.size())
+                || szChunk != szInflated)
+            return false;
+    } else {
+        if (szChunk != raw.size())
+            return false;
+        std::memcpy(chunk, raw.data(), szChunk);
+    }
+    if (!isWhole) {
+        std::copy(chunk + (from - chunkStart), chunk + (to - chunkStart),
+                target);
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+struct InflateThreadParam {
+    const RawChunkSet *chunks;
+    IntType *buffer;
+    int *nextChunk;
+    std::vector<IntType> *scratch;  // NULL for a buffer of the thread
+    bool isError;
+};
+//------------------------------------------------------------------------------
+void *thread_inflate_chunks(void *arg) {
+    InflateThreadParam *p = (InflateThreadParam *)arg;
+    std::vector<IntType> ownScratch;
+    std::vector<IntType> &scratch
+            = (NULL != p->scratch) ? *p->scratch : ownScratch;
+    while (true) {
+        const int k = __sync_fetch_and_add(p->nextChunk, 1);
+        if (p->chunks->numChunks <= k)
+            break;
+        if (!inflate_chunk(*p->chunks, k, p->buffer, scratch))
+            p->isError = true;
+    }
+    return NULL;
+}
+//------------------------------------------------------------------------------
+// Chunks are shared by numThreads threads, the calling one included, which
+// takes all that are left if no thread can be started. The calling thread
+// decodes partial chunks into chunks.scratch, so that a single-threaded
+// call allocates nothing once the buffers have grown.
+bool inflate_chunks(
+        RawChunkSet &chunks, IntType *buffer, const int numThreads) {
+    const int nThreads = std::max(1, std::min(numThreads, chunks.numChunks));
+    int nextChunk = 0;
+    InflateThreadParam self;
+    self.chunks = &chunks;
+    self.buffer = buffer;
+    self.nextChunk = &nextChunk;
+    self.scratch = &chunks.scratch;
+    self.isError = false;
+    std::vector<InflateThreadParam> param(nThreads - 1, self);
+    std::vector<pthread_t> thid(nThreads - 1);
+    int nStarted = 0;
+    for (int i = 0; i < nThreads - 1; ++i, ++nStarted) {
+        param[i].scratch = NULL;
+        if (0 != pthread_create(
+                    &thid[i], NULL, thread_inflate_chunks, &param[i]))
+            break;
+    }
+    thread_inflate_chunks(&self);
+    bool isError = self.isError;
+    for (int i = 0; i < nStarted; ++i) {
+        pthread_join(thid[i], NULL);
+        isError = isError || param[i].isError;
+    }
+    if (isError) {
+        std::cerr << ERROR_STRING << "can't inflate a chunk. start="
+                  << chunks.start << ", count=" << chunks.count << ENDL;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+bool HdfBaseDepthReader::load_sparse(
+        DataSetHandle *handle, const char *dataName) {
+    try {
+        H5::Exception::dontPrint();
+        H5::Group group = hdfGroup->openGroup(dataName);
+
+        H5::Attribute encodingAttr
+                = group.openAttribute(EX_HDFBDR_ENCODING_ATTR);
+        std::string encoding;
+        encodingAttr.read(encodingAttr.getStrType(), encoding);
+        H5::Attribute lengthAttr
+                = group.openAttribute(EX_HDFBDR_SPARSE_LENGTH_ATTR);
+        lengthAttr.read(H5::PredType::NATIVE_INT, &handle->sparseLength);
+        if (EX_HDFBDR_ENCODING_RLE == encoding) {
+            handle->isRunLength = true;
+        } else if (EX_HDFBDR_ENCODING_COO == encoding) {
+            handle->isRunLength = false;
+        } else {
+            std::cerr << ERROR_STRING << "unknown encoding '" << encoding
+                      << "' of a dataset '" << dataName << "'." << ENDL;
+            return false;
+        }
+
+        H5::DataSet position = group.openDataSet(EX_HDFBDR_SPARSE_POSITION);
+        H5::DataSet value = group.openDataSet(EX_HDFBDR_SPARSE_VALUE);
+        const hssize_t nItems = position.getSpace().getSimpleExtentNpoints();
+        handle->sparsePosition.resize(nItems);
+        handle->sparseValue.resize(nItems);
+        if (0 < nItems) {
+            position.read(
+                    handle->sparsePosition.data(), H5::PredType::NATIVE_INT);
+            value.read(handle->sparseValue.data(), H5::PredType::NATIVE_INT32);
+        }
+    } catch (H5::Exception err) {
+        std::cerr << ERROR_STRING << "can't read a sparse dataset '"
                   << dataName << "'." << ENDL;
         return false;
-    } catch (H5::DataSpaceIException err) {
-        std::cerr << ERROR_STRING << "can't create a dataspace." << ENDL;
+    }
+    handle->isSparse = true;
+    return true;
+}
+//------------------------------------------------------------------------------
+void HdfBaseDepthReader::expand_sparse(
+        const int start, const int count, IntType *buffer) {
+    const std::vector<int> &sparsePosition = currentHandle->sparsePosition;
+    const std::vector<IntType> &sparseValue = currentHandle->sparseValue;
+    const int end = start + count;
+    if (isRunLength) {
+        // the run containing 'start'; runs cover the whole track from 0
+        size_t run = std::upper_bound(sparsePosition.begin(),
+                             sparsePosition.end(), start)
+                - sparsePosition.begin() - 1;
+        for (int pos = start; pos < end; ++run) {
+            const int runEnd = (run + 1 < sparsePosition.size())
+                    ? std::min(end, sparsePosition[run + 1])
+                    : end;
+            std::fill(buffer + pos - start, buffer + runEnd - start,
+                    sparseValue[run]);
+            pos = runEnd;
+        }
+        return;
+    }
+
+    std::fill(buffer, buffer + count, 0);
+    for (size_t i = std::lower_bound(sparsePosition.begin(),
+                 sparsePosition.end(), start)
+                    - sparsePosition.begin();
+            i < sparsePosition.size() && sparsePosition[i] < end; ++i) {
+        buffer[sparsePosition[i] - start] = sparseValue[i];
+    }
+    return;
+}
+//------------------------------------------------------------------------------
+// Runs of equal values in [start, start + count). Sparse tracks are converted
+// without expanding them, so callers may skip long zero runs.
+bool HdfBaseDepthReader::get_runs(const int *start, const int *count,
+        std::vector<int> &runStart, std::vector<IntType> &runValue) {
+    runStart.clear();
+    runValue.clear();
+    const int end = *start + *count;
+    const bool isCompact = isSparse && !isRestricted;
+    if (isCompact && (0 > *start || sparseLength < end)) {
+        std::cerr << ERROR_STRING << "can't read data from a dataspace."
+                  << " start=" << *start << ", count=" << *count << ENDL;
         return false;
     }
+    // dense or restricted track
+    if (!isCompact) {
+        if (runBuffer.size() < (size_t)*count)
+            runBuffer.resize(*count);
+        if (!get_matrix(start, count, runBuffer.data()))
+            return false;
+        for (int i = 0; i < *count; ++i) {
+            if (0 == i || runBuffer[i] != runBuffer[i - 1]) {
+                runStart.push_back(*start + i);
+                runValue.push_back(runBuffer[i]);
+            }
+        }
+        return true;
+    }
 
-    currentDataName = dataName;
-    currentDataType = dataType;
+    const std::vector<int> &sparsePosition = currentHandle->sparsePosition;
+    const std::vector<IntType> &sparseValue = currentHandle->sparseValue;
+    if (isRunLength) {
+        size_t run = std::upper_bound(sparsePosition.begin(),
+                             sparsePosition.end(), *start)
+                - sparsePosition.begin() - 1;
+        runStart.push_back(*start);
+        runValue.push_back(sparseValue[run]);
+        for (++run; run < sparsePosition.size() && sparsePosition[run] < end;
+                ++run) {
+            runStart.push_back(sparsePosition[run]);
+            runValue.push_back(sparseValue[run]);
+        }
+        return true;
+    }
+    int pos = *start;
+    for (size_t i = std::lower_bound(sparsePosition.begin(),
+                 sparsePosition.end(), *start)
+                    - sparsePosition.begin();
+            i < sparsePosition.size() && sparsePosition[i] < end; ++i) {
+        if (pos < sparsePosition[i]) {
+            runStart.push_back(pos);
+            runValue.push_back(0);
+        }
+        runStart.push_back(sparsePosition[i]);
+        runValue.push_back(sparseValue[i]);
+        pos = sparsePosition[i] + 1;
+    }
+    if (pos < end) {
+        runStart.push_back(pos);
+        runValue.push_back(0);
+    }
     return true;
 }
 //------------------------------------------------------------------------------
+// Genomic coordinates of a restricted matrix are mapped to the intervals
+// overlapping [start, start + count) and the bases between them are zero.
 bool HdfBaseDepthReader::get_matrix(
         const int *start, const int *count, IntType *buffer) {
+    if (!isRestricted)
+        return read_matrix(start, count, buffer);
+    if (0 > *start || chromLength < *start + *count) {
+        std::cerr << ERROR_STRING << "can't read data from a dataspace."
+                  << " start=" << *start << ", count=" << *count << ENDL;
+        return false;
+    }
+
+    std::fill(buffer, buffer + *count, 0);
+    const int end = *start + *count;
+    for (size_t r = std::upper_bound(regionEnd.begin(), regionEnd.end(),
+                            *start)
+                    - regionEnd.begin();
+            r < regionStart.size() && regionStart[r] < end; ++r) {
+        const int from = std::max(*start, regionStart[r]);
+        const int offset = regionOffset[r] + from - regionStart[r];
+        const int length = std::min(end, regionEnd[r]) - from;
+        if (!read_matrix(&offset, &length, buffer + from - *start))
+            return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+bool HdfBaseDepthReader::read_matrix(
+        const int *start, const int *count, IntType *buffer) {
     if (!isFileOpened)
         return false;
+    if (isSparse) {
+        if (0 > *start || sparseLength < *start + *count) {
+            std::cerr << ERROR_STRING << "can't read data from a dataspace."
+                      << " start=" << *start << ", count=" << *count << ENDL;
+            return false;
+        }
+        expand_sparse(*start, *count, buffer);
+        return true;
+    }
+    if (1 < inflateThreads && isRawChunked
+            && EX_HDFBDR_INFLATE_MIN_CHUNKS * chunkSize <= *count) {
+        return read_raw_chunks(start, count, rawChunks)
+                && inflate_chunks(rawChunks, buffer, inflateThreads);
+    }
 
-    hsize_t f_offset[1], m_offset[1], h_count[1];
+    hsize_t f_offset[1], h_count[1];
     f_offset[0] = *start;
-    m_offset[0] = 0;
     h_count[0] = *count;
 
     try {
         H5::Exception::dontPrint();
-        H5::DataSpace *memspace = new H5::DataSpace(1, h_count);
-        memspace->selectHyperslab(H5S_SELECT_SET, h_count, m_offset);
+        // a new extent selects all of the memory dataspace
+        if (memSpaceSize != h_count[0]) {
+            memSpace.setExtentSimple(1, h_count);
+            memSpaceSize = h_count[0];
+        }
         hdfDataSpace->selectHyperslab(H5S_SELECT_SET, h_count, f_offset);
         hdfDataSet->read(
-                (void *)buffer, currentDataType, *memspace, *hdfDataSpace);
-        delete memspace;
+                (void *)buffer, currentDataType, memSpace, *hdfDataSpace);
     } catch (H5::DataSetIException err) {
         std::cerr << ERROR_STRING << "can't read data from a dataspace."
                   << " start=" << *start << ", count=" << *count << ENDL;
@@ -121,7 +609,48 @@ bool HdfBaseDepthReader::get_unique_read_count(
     return false;
 }
 //------------------------------------------------------------------------------
+// The histogram of a chromosome is added to 'histogram', which grows as
+// needed, so that a genome-wide one is summed up over the groups
+// -- Added in the matrix Version 0.6
+bool HdfBaseDepthReader::get_depth_histogram(
+        const char *chr, std::vector<long> &histogram) {
+    if (!set_target_chromosome(chr)
+            || !set_target_dataset(
+                    EX_HDFBDR_DEPTH_HISTOGRAM, H5::PredType::NATIVE_INT32))
+        return false;
+    std::vector<IntType> bins(hdfDataSpace->getSimpleExtentNpoints());
+    if (!bins.empty()) {
+        hdfDataSet->read(bins.data(), H5::PredType::NATIVE_INT32);
+    }
+    if (histogram.size() < bins.size())
+        histogram.resize(bins.size(), 0);
+    for (size_t i = 0; i < bins.size(); ++i)
+        histogram[i] += bins[i];
+    return true;
+}
+//------------------------------------------------------------------------------
+// EX_HDFBDR_SUMMARY_SIZE values in the order of EX_HDFBDR_SUMMARY_*
+// -- Added in the matrix Version 0.6
+bool HdfBaseDepthReader::get_depth_summary(const char *chr, double *summary) {
+    if (!set_target_chromosome(chr)
+            || !set_target_dataset(
+                    EX_HDFBDR_DEPTH_SUMMARY, H5::PredType::NATIVE_DOUBLE))
+        return false;
+    if (EX_HDFBDR_SUMMARY_SIZE != hdfDataSpace->getSimpleExtentNpoints()) {
+        std::cerr << ERROR_STRING << "unexpected size of '"
+                  << EX_HDFBDR_DEPTH_SUMMARY << "' in '" << chr << "'."
+                  << ENDL;
+        return false;
+    }
+    hdfDataSet->read(summary, H5::PredType::NATIVE_DOUBLE);
+    return true;
+}
+//------------------------------------------------------------------------------
 int HdfBaseDepthReader::get_num_elements(void) {
+    if (isRestricted)
+        return chromLength;
+    if (isSparse)
+        return sparseLength;
     if (!isDataSpaceAllocated)
         return -1;
 
@@ -134,22 +663,19 @@ int HdfBaseDepthReader::get_num_elements(void) {
 }
 //------------------------------------------------------------------------------
 void HdfBaseDepthReader::close(void) {
-    if (isFileOpened) {
-        delete hdfFile;
-        isFileOpened = false;
-    }
-    if (isDataSpaceAllocated) {
-        delete hdfDataSpace;
-        isDataSpaceAllocated = false;
-    }
-    if (isDataSetAllocated) {
-        delete hdfDataSet;
-        isDataSetAllocated = false;
-    }
+    clear_handles();
     if (isGroupAllocated) {
         delete hdfGroup;
         isGroupAllocated = false;
     }
+    if (isFileOpened) {
+        delete hdfFile;
+        isFileOpened = false;
+    }
+    currentChrName = "";
+    isSparse = false;
+    isRestricted = false;
+    isRawChunked = false;
 }
 //------------------------------------------------------------------------------
 HdfBaseDepthReader::HdfBaseDepthReader() {
@@ -157,6 +683,19 @@ HdfBaseDepthReader::HdfBaseDepthReader() {
     isGroupAllocated = false;
     isDataSetAllocated = false;
     isDataSpaceAllocated = false;
+    isSparse = false;
+    isRunLength = false;
+    sparseLength = 0;
+    isRestricted = false;
+    chromLength = 0;
+    isRawChunked = false;
+    isDeflated = false;
+    chunkSize = datasetLength = 0;
+    inflateThreads = 1;
+    fillValue = 0;
+    currentHandle = NULL;
+    handleClock = 0;
+    memSpaceSize = 0;
 }
 //------------------------------------------------------------------------------
 HdfBaseDepthReader::~HdfBaseDepthReader() {
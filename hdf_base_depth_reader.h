@@ -6,33 +6,153 @@
 #include <H5Cpp.h>
 #include <iostream>
 #include <string>
+#include <vector>
+
+// sparse tracks are groups holding Position and Value arrays
+#define EX_HDFBDR_ENCODING_ATTR "Encoding"
+#define EX_HDFBDR_ENCODING_COO "coo"
+#define EX_HDFBDR_ENCODING_RLE "rle"
+#define EX_HDFBDR_SPARSE_LENGTH_ATTR "Length"
+#define EX_HDFBDR_SPARSE_POSITION "Position"
+#define EX_HDFBDR_SPARSE_VALUE "Value"
+
+// target intervals of a restricted matrix
+#define EX_HDFBDR_REGION_START "RegionStart"
+#define EX_HDFBDR_REGION_END "RegionEnd"
+#define EX_HDFBDR_REGION_OFFSET "RegionOffset"
+
+// base depth distribution of a chromosome; the last histogram bin also holds
+// all deeper bases
+#define EX_HDFBDR_DEPTH_HISTOGRAM "DepthHistogram"
+#define EX_HDFBDR_DEPTH_SUMMARY "DepthSummary"
+// items of DepthSummary
+#define EX_HDFBDR_SUMMARY_BASES 0
+#define EX_HDFBDR_SUMMARY_TOTAL_DEPTH 1
+#define EX_HDFBDR_SUMMARY_MEAN_DEPTH 2
+#define EX_HDFBDR_SUMMARY_SD_DEPTH 3
+#define EX_HDFBDR_SUMMARY_MAX_DEPTH 4
+#define EX_HDFBDR_SUMMARY_SIZE 5
+
+// reads of at least this many chunks are decoded by the threads given to
+// set_inflate_threads(); shorter ones go through the HDF5 chunk cache
+#define EX_HDFBDR_INFLATE_MIN_CHUNKS 4
+// datasets kept open by (chromosome, dataset) name
+#define EX_HDFBDR_HANDLE_CACHE_SIZE 16
 
 //------------------------------------------------------------------------------
 typedef int32_t IntType;
 //------------------------------------------------------------------------------
+// Compressed chunks of a region of a dense track, as stored in the file.
+// They are fetched by HdfBaseDepthReader::read_raw_chunks() and decoded by
+// inflate_chunks(), which makes no HDF5 call, so that callers serializing
+// HDF5 can decode outside their lock or on several threads. Keep one per
+// thread and reuse it to keep the buffers.
+struct RawChunkSet {
+    int start, count;
+    int chunkSize;      // elements per chunk
+    int firstChunk;     // index of the chunk holding 'start'
+    int numChunks;
+    bool isDeflated;    // deflate is the only filter, unless skipped
+    IntType fillValue;  // of chunks never written
+    std::vector<std::vector<unsigned char> > data;  // empty if not written
+    std::vector<unsigned int> filterMask;
+    std::vector<IntType> scratch;  // partial chunks of the calling thread
+};
+bool inflate_chunks(RawChunkSet &chunks, IntType *buffer, const int numThreads);
+//------------------------------------------------------------------------------
 class HdfBaseDepthReader {
 public:
     bool open(const char *filename);
     bool set_target_chromosome(const char *chr_str);
     bool set_target_dataset(const char *dataName, const H5::DataType dataType);
     bool get_matrix(const int *start, const int *count, IntType *buffer);
+    bool get_runs(const int *start, const int *count,
+            std::vector<int> &runStart, std::vector<IntType> &runValue);
+    bool is_sparse(void) const { return isSparse; }
+    bool is_restricted(void) const { return isRestricted; }
+    // true when read_raw_chunks() takes the coordinates of get_matrix()
+    bool can_read_raw_chunks(void) const {
+        return isRawChunked && !isSparse && !isRestricted;
+    }
+    bool read_raw_chunks(
+            const int *start, const int *count, RawChunkSet &chunks);
+    int get_chunk_size(void) const { return isRawChunked ? chunkSize : 0; }
+    void set_inflate_threads(const int numThreads) {
+        inflateThreads = (0 < numThreads) ? numThreads : 1;
+    }
     bool get_group_names(hi::StringArray &groups);
     bool get_unique_read_count(const char *chr, int *read_count);
+    bool get_depth_histogram(const char *chr, std::vector<long> &histogram);
+    bool get_depth_summary(const char *chr, double *summary);
     int get_num_elements(void);
     void close(void);
     HdfBaseDepthReader();
     ~HdfBaseDepthReader();
 
 protected:
+    // Datasets opened so far, by chromosome and dataset name, so that going
+    // back to one reuses its handles (dense) or arrays (sparse). The least
+    // recently used one is replaced beyond EX_HDFBDR_HANDLE_CACHE_SIZE.
+    struct DataSetHandle {
+        std::string chrom, name;
+        bool isOpen;
+        long lastUse;
+        // dense track and its raw chunk layout (see check_raw_chunks())
+        H5::DataSet dataSet;
+        H5::DataSpace dataSpace;
+        bool isRawChunked, isDeflated;
+        int chunkSize, datasetLength;
+        IntType fillValue;
+        // sparse track, held in memory
+        bool isSparse, isRunLength;
+        int sparseLength;
+        std::vector<int> sparsePosition;
+        std::vector<IntType> sparseValue;
+    };
+    DataSetHandle *find_handle(const char *dataName);
+    DataSetHandle *open_handle(const char *dataName);
+    void clear_handles(void);
+    std::vector<DataSetHandle *> handles;
+    DataSetHandle *currentHandle;
+    long handleClock;
+
     H5::H5File *hdfFile;
     H5::Group *hdfGroup;
-    H5::DataSet *hdfDataSet;
-    H5::DataSpace *hdfDataSpace;
+    H5::DataSet *hdfDataSet;      // of currentHandle
+    H5::DataSpace *hdfDataSpace;  // of currentHandle
 
     std::string currentChrName, currentDataName;
     H5::DataType currentDataType;
     bool isFileOpened, isGroupAllocated, isDataSetAllocated,
             isDataSpaceAllocated;
+
+    // memory dataspace of read_matrix(), resized only when the count changes
+    H5::DataSpace memSpace;
+    hsize_t memSpaceSize;
+    std::vector<IntType> runBuffer;  // dense tracks in get_runs()
+
+    // sparse track of the current dataset
+    bool load_sparse(DataSetHandle *handle, const char *dataName);
+    void expand_sparse(const int start, const int count, IntType *buffer);
+    bool isSparse, isRunLength;
+    int sparseLength;
+
+    // target intervals of the current chromosome; tracks of a restricted
+    // matrix hold only these bases and the rest reads as zero
+    bool load_regions(void);
+    bool read_matrix(const int *start, const int *count, IntType *buffer);
+    bool isRestricted;
+    int chromLength;
+    std::vector<int> regionStart, regionEnd, regionOffset;
+
+    // chunks of a dense track read raw and inflated by inflateThreads;
+    // only for 1-D int32 tracks compressed by deflate alone, not for
+    // virtual datasets
+    void check_raw_chunks(DataSetHandle *handle);
+    bool isRawChunked, isDeflated;
+    int chunkSize, datasetLength, inflateThreads;
+    IntType fillValue;
+    RawChunkSet rawChunks;
 };
 //------------------------------------------------------------------------------
 herr_t add_group(hid_t loc_id, const char *namestr, const H5L_info_t *linfo,
@@ -0,0 +1,178 @@
+#include "ordered_writer.h"
+
+#include <algorithm>
+#include <vector>
+
+//------------------------------------------------------------------------------
+bool OrderedWriter::start(std::ostream *ost, const int maxPending) {
+    this->ost = ost;
+    this->maxPending = std::max(1, maxPending);
+    nextSequence = 0;
+    peakPending = 0;
+    isFinished = false;
+    pending.clear();
+    writeCounter.clear();
+    if (0 != pthread_create(&thread, NULL, run, this)) {
+        std::cerr << ERROR_STRING << "failed to start the output thread."
+                  << ENDL;
+        return false;
+    }
+    isStarted = true;
+    return true;
+}
+//------------------------------------------------------------------------------
+// The block is taken over by swapping, so 'block' is left empty.
+void OrderedWriter::put(const long sequence, std::string &block) {
+    pthread_mutex_lock(&mutex);
+    while (sequence >= nextSequence + maxPending)
+        pthread_cond_wait(&spaceCond, &mutex);
+    pending[sequence].swap(block);
+    peakPending = std::max(peakPending, pending.size());
+    if (sequence == nextSequence)
+        pthread_cond_signal(&readyCond);
+    pthread_mutex_unlock(&mutex);
+    return;
+}
+//------------------------------------------------------------------------------
+bool OrderedWriter::finish(void) {
+    if (!isStarted)
+        return false;
+    pthread_mutex_lock(&mutex);
+    isFinished = true;
+    pthread_cond_signal(&readyCond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    isStarted = false;
+
+    if (!pending.empty()) {
+        std::cerr << ERROR_STRING << pending.size() << " output block(s) "
+                  << "after a missing one were not written." << ENDL;
+        return false;
+    }
+    ost->flush();
+    return !ost->fail();
+}
+//------------------------------------------------------------------------------
+void *OrderedWriter::run(void *arg) {
+    ((OrderedWriter *)arg)->write_blocks();
+    return NULL;
+}
+//------------------------------------------------------------------------------
+// the stream is written outside the lock so that workers keep putting
+void OrderedWriter::write_blocks(void) {
+    std::string block;
+    StageTimer timer;
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        std::map<long, std::string>::iterator next
+                = pending.find(nextSequence);
+        if (pending.end() == next) {
+            if (isFinished)
+                break;
+            pthread_cond_wait(&readyCond, &mutex);
+            continue;
+        }
+        block.swap(next->second);
+        pending.erase(next);
+        const long sequence = nextSequence++;
+        pthread_cond_broadcast(&spaceCond);
+        pthread_mutex_unlock(&mutex);
+
+        timer.start();
+        write_block(sequence, block);
+        timer.stop(&writeCounter, block.length(), 1);
+        block.clear();
+
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    write_end();
+    return;
+}
+//------------------------------------------------------------------------------
+void OrderedWriter::write_block(const long sequence, const std::string &block) {
+    ost->write(block.data(), block.length());
+}
+//------------------------------------------------------------------------------
+OrderedWriter::OrderedWriter() {
+    ost = NULL;
+    nextSequence = 0;
+    maxPending = 1;
+    peakPending = 0;
+    isStarted = isFinished = false;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&readyCond, NULL);
+    pthread_cond_init(&spaceCond, NULL);
+}
+//------------------------------------------------------------------------------
+OrderedWriter::~OrderedWriter() {
+    if (isStarted)
+        finish();
+    pthread_cond_destroy(&spaceCond);
+    pthread_cond_destroy(&readyCond);
+    pthread_mutex_destroy(&mutex);
+}
+//------------------------------------------------------------------------------
+struct OrderedBlockParam {
+    OrderedBlockFunc process_block;
+    void *context;
+    int thread;
+    long numBlocks;
+    long *nextBlock;
+    pthread_mutex_t *blockMutex;
+    bool isError;
+};
+//------------------------------------------------------------------------------
+void *thread_run_ordered_blocks(void *arg) {
+    OrderedBlockParam *param = (OrderedBlockParam *)arg;
+    while (true) {
+        pthread_mutex_lock(param->blockMutex);
+        const long b = (*param->nextBlock)++;
+        pthread_mutex_unlock(param->blockMutex);
+        if (param->numBlocks <= b)
+            break;
+        if (!param->process_block(param->context, param->thread, b))
+            param->isError = true;
+    }
+    return NULL;
+}
+//------------------------------------------------------------------------------
+bool run_ordered_blocks(const long numBlocks, const int numThreads,
+        OrderedBlockFunc process_block, void *context) {
+    const int nThreads = std::max(1, numThreads);
+    pthread_mutex_t blockMutex;
+    pthread_mutex_init(&blockMutex, NULL);
+    long nextBlock = 0;
+    std::vector<pthread_t> thid(nThreads);
+    std::vector<OrderedBlockParam> param(nThreads);
+    int nStarted = 0;
+    for (int i = 0; i < nThreads; ++i) {
+        param[i].process_block = process_block;
+        param[i].context = context;
+        param[i].thread = i;
+        param[i].numBlocks = numBlocks;
+        param[i].nextBlock = &nextBlock;
+        param[i].blockMutex = &blockMutex;
+        param[i].isError = false;
+        if (0 != pthread_create(
+                    &thid[i], NULL, thread_run_ordered_blocks, &param[i])) {
+            std::cerr << WARNING_STRING << "failed to start a thread. "
+                      << "Continued with " << nStarted << "." << ENDL;
+            break;
+        }
+        ++nStarted;
+    }
+    if (0 == nStarted) {
+        thread_run_ordered_blocks(&param[0]);
+        nStarted = 1;
+    } else {
+        for (int i = 0; i < nStarted; ++i)
+            pthread_join(thid[i], NULL);
+    }
+    bool isError = false;
+    for (int i = 0; i < nStarted; ++i)
+        isError = isError || param[i].isError;
+    pthread_mutex_destroy(&blockMutex);
+    return !isError;
+}
+//------------------------------------------------------------------------------
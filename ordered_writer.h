@@ -0,0 +1,70 @@
+#ifndef ORDERED_WRITER_H
+#define ORDERED_WRITER_H
+
+#include "histd.h"
+
+#include "stage_stats.h"
+
+#include <map>
+#include <ostream>
+#include <pthread.h>
+#include <string>
+
+//------------------------------------------------------------------------------
+// Reorder buffer for output blocks computed in parallel. Workers put blocks
+// tagged with consecutive sequence numbers from 0 in any order, and a writer
+// thread emits them to the stream strictly in sequence while the workers go
+// on. A block more than maxPending ahead of the next one to write waits in
+// put(), which bounds the memory held by out-of-order blocks. As the next
+// block is always within the window its worker never waits, so workers that
+// take sequence numbers in increasing order can not deadlock.
+//
+// Every sequence number up to the last one must be put, even as an empty
+// block, before finish().
+//
+// Blocks are written by write_block() on the writer thread in sequence, and
+// write_end() is called after the last one. A subclass may override them to
+// join what adjacent blocks leave open at their boundaries; finish() must be
+// called before such a subclass is destroyed.
+class OrderedWriter {
+public:
+    bool start(std::ostream *ost, const int maxPending);
+    void put(const long sequence, std::string &block);
+    bool finish(void);
+    size_t get_peak_pending(void) const { return peakPending; }
+    // time and bytes of the stream writes, valid after finish()
+    const StageCounter &get_write_counter(void) const { return writeCounter; }
+    OrderedWriter();
+    virtual ~OrderedWriter();
+
+protected:
+    static void *run(void *arg);
+    void write_blocks(void);
+    virtual void write_block(const long sequence, const std::string &block);
+    virtual void write_end(void) {}
+
+    std::ostream *ost;
+    std::map<long, std::string> pending;
+    long nextSequence;
+    int maxPending;
+    size_t peakPending;
+    StageCounter writeCounter;
+    bool isStarted, isFinished;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t readyCond, spaceCond;
+};
+//------------------------------------------------------------------------------
+// Block dispatch for an OrderedWriter: process_block(context, thread, block)
+// is called for the blocks 0 .. numBlocks - 1 by numThreads threads, each
+// taking the next block in increasing order. 'thread' selects the state of
+// the calling thread in 'context'. A block that fails must still be put to
+// the writer so that the later ones are written. When no thread can be
+// started, the blocks are processed on the calling thread as thread 0.
+// Returns false when any call does.
+typedef bool (*OrderedBlockFunc)(
+        void *context, const int thread, const long block);
+bool run_ordered_blocks(const long numBlocks, const int numThreads,
+        OrderedBlockFunc process_block, void *context);
+//------------------------------------------------------------------------------
+#endif
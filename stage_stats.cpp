@@ -0,0 +1,179 @@
+#include "stage_stats.h"
+
+#include <cerrno>
+#include <sys/resource.h>
+
+//------------------------------------------------------------------------------
+void StageCounter::add(const StageCounter &other) {
+    wallSeconds += other.wallSeconds;
+    cpuSeconds += other.cpuSeconds;
+    bytes += other.bytes;
+    records += other.records;
+    calls += other.calls;
+}
+//------------------------------------------------------------------------------
+bool StageStats::StageKey::operator<(const StageKey &right) const {
+    if (stage != right.stage)
+        return stage < right.stage;
+    if (thread != right.thread)
+        return thread < right.thread;
+    return chrom < right.chrom;
+}
+//------------------------------------------------------------------------------
+void StageStats::add(const std::string &stage, const std::string &thread,
+        const std::string &chrom, const StageCounter &counter) {
+    StageKey key;
+    key.stage = stage;
+    key.thread = thread;
+    key.chrom = chrom;
+    pthread_mutex_lock(&mutex);
+    counters[key].add(counter);
+    pthread_mutex_unlock(&mutex);
+}
+//------------------------------------------------------------------------------
+std::string escape_json(const std::string &text) {
+    std::string escaped;
+    for (size_t i = 0; i < text.length(); ++i) {
+        if ('"' == text[i] || '\\' == text[i])
+            escaped += '\\';
+        escaped += text[i];
+    }
+    return escaped;
+}
+//------------------------------------------------------------------------------
+void write_counter(const StageCounter &counter, std::ostream &ofs) {
+    ofs << ", \"wall_seconds\": " << counter.wallSeconds;
+    if (0 <= counter.cpuSeconds)
+        ofs << ", \"cpu_seconds\": " << counter.cpuSeconds;
+    ofs << ", \"bytes\": " << counter.bytes << ", \"records\": "
+        << counter.records << ", \"calls\": " << counter.calls << "}";
+}
+//------------------------------------------------------------------------------
+// One entry per stage, thread and chromosome, and the totals per stage. An
+// empty chromosome means the stage is not tied to one.
+bool StageStats::write_json(const std::string &fn, const std::string &program) {
+    std::ofstream ofs(fn.c_str());
+    if (ofs.fail()) {
+        std::cerr << ERROR_STRING << "can't open the stats file (" << fn
+                  << ")." << ENDL;
+        return false;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double cpuSeconds = usage.ru_utime.tv_sec
+            + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec
+            + usage.ru_stime.tv_usec * 1e-6;
+
+    pthread_mutex_lock(&mutex);
+    std::map<std::string, StageCounter> totals;
+    ofs << "{\n  \"program\": \"" << escape_json(program) << "\",\n"
+        << "  \"wall_seconds\": " << get_wall_clock() - startWall << ",\n"
+        << "  \"cpu_seconds\": " << cpuSeconds << ",\n"
+        << "  \"peak_rss_kb\": " << usage.ru_maxrss << ",\n"
+        << "  \"stages\": [";
+    for (std::map<StageKey, StageCounter>::const_iterator c = counters.begin();
+            c != counters.end(); ++c) {
+        ofs << ((counters.begin() == c) ? "\n" : ",\n") << "    {\"stage\": \""
+            << escape_json(c->first.stage) << "\", \"thread\": \""
+            << escape_json(c->first.thread) << "\", \"chromosome\": \""
+            << escape_json(c->first.chrom) << "\"";
+        write_counter(c->second, ofs);
+        StageCounter &total = totals[c->first.stage];
+        const bool isCpuMeasured
+                = (0 <= total.cpuSeconds && 0 <= c->second.cpuSeconds);
+        total.add(c->second);
+        if (!isCpuMeasured)
+            total.cpuSeconds = -1;
+    }
+    ofs << "\n  ],\n  \"totals\": [";
+    for (std::map<std::string, StageCounter>::const_iterator t
+            = totals.begin();
+            t != totals.end(); ++t) {
+        ofs << ((totals.begin() == t) ? "\n" : ",\n") << "    {\"stage\": \""
+            << escape_json(t->first) << "\"";
+        write_counter(t->second, ofs);
+    }
+    ofs << "\n  ]\n}\n";
+    pthread_mutex_unlock(&mutex);
+    ofs.close();
+    if (ofs.fail()) {
+        std::cerr << ERROR_STRING << "failed to write the stats file (" << fn
+                  << ")." << ENDL;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+bool StageStats::start_progress(const double interval,
+        const std::string &recordName, const std::string &itemName,
+        const long totalItems) {
+    this->interval = (0 < interval) ? interval : EX_STATS_PROGRESS_INTERVAL;
+    this->recordName = recordName;
+    this->itemName = itemName;
+    this->totalItems = totalItems;
+    isProgressRunning = true;
+    if (0 != pthread_create(&progressThread, NULL, run_progress, this)) {
+        std::cerr << WARNING_STRING << "failed to start the progress thread."
+                  << ENDL;
+        isProgressRunning = false;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+void StageStats::stop_progress(void) {
+    pthread_mutex_lock(&mutex);
+    const bool isRunning = isProgressRunning;
+    isProgressRunning = false;
+    pthread_cond_signal(&progressCond);
+    pthread_mutex_unlock(&mutex);
+    if (isRunning)
+        pthread_join(progressThread, NULL);
+}
+//------------------------------------------------------------------------------
+void *StageStats::run_progress(void *arg) {
+    StageStats *stats = (StageStats *)arg;
+    pthread_mutex_lock(&stats->mutex);
+    while (stats->isProgressRunning) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        const double next
+                = deadline.tv_sec + deadline.tv_nsec * 1e-9 + stats->interval;
+        deadline.tv_sec = (time_t)next;
+        deadline.tv_nsec = (long)((next - deadline.tv_sec) * 1e9);
+        int rc = 0;
+        while (stats->isProgressRunning && ETIMEDOUT != rc)
+            rc = pthread_cond_timedwait(
+                    &stats->progressCond, &stats->mutex, &deadline);
+        if (stats->isProgressRunning)
+            stats->print_progress();
+    }
+    pthread_mutex_unlock(&stats->mutex);
+    return NULL;
+}
+//------------------------------------------------------------------------------
+void StageStats::print_progress(void) {
+    const double elapsed = get_wall_clock() - startWall;
+    const long records = progressRecords;
+    std::cerr << INFO_STRING << "progress: " << (long)(elapsed * 10) / 10.0
+              << " s, "
+              << records << " " << recordName << " ("
+              << (long)(records / std::max(elapsed, 1e-3)) << "/s), "
+              << progressItems << "/" << totalItems << " " << itemName << ENDL;
+}
+//------------------------------------------------------------------------------
+StageStats::StageStats() {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&progressCond, NULL);
+    startWall = get_wall_clock();
+    progressRecords = progressItems = totalItems = 0;
+    interval = EX_STATS_PROGRESS_INTERVAL;
+    isProgressRunning = false;
+}
+//------------------------------------------------------------------------------
+StageStats::~StageStats() {
+    stop_progress();
+    pthread_cond_destroy(&progressCond);
+    pthread_mutex_destroy(&mutex);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,106 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#include "histd.h"
+
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <time.h>
+
+// progress lines every this many seconds unless given
+#define EX_STATS_PROGRESS_INTERVAL 10
+// records counted locally before they are added to the shared progress
+#define EX_STATS_PROGRESS_STEP 65536
+
+//------------------------------------------------------------------------------
+inline double get_wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+//------------------------------------------------------------------------------
+// CPU time of the calling thread
+inline double get_thread_cpu_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+//------------------------------------------------------------------------------
+// time and volume of one stage; cpuSeconds is negative when not measured
+struct StageCounter {
+    double wallSeconds, cpuSeconds;
+    long bytes, records, calls;
+    void add(const StageCounter &other);
+    void clear(void) {
+        wallSeconds = cpuSeconds = 0;
+        bytes = records = calls = 0;
+    }
+    StageCounter() { clear(); }
+};
+//------------------------------------------------------------------------------
+// Wall and CPU time of a stage on the calling thread, for stages long enough
+// that two clock reads do not matter (per chromosome or per block).
+class StageTimer {
+public:
+    void start(void) {
+        wall = get_wall_clock();
+        cpu = get_thread_cpu_clock();
+    }
+    void stop(StageCounter *counter, const long bytes, const long records) {
+        counter->wallSeconds += get_wall_clock() - wall;
+        counter->cpuSeconds += get_thread_cpu_clock() - cpu;
+        counter->bytes += bytes;
+        counter->records += records;
+        ++(counter->calls);
+    }
+    StageTimer() : wall(0), cpu(0) {}
+
+protected:
+    double wall, cpu;
+};
+//------------------------------------------------------------------------------
+// Per-stage counters of a run, kept per thread and chromosome. Workers sum
+// into their own StageCounter and add it here once per chromosome or block,
+// so the shared map is locked rarely. Nothing is measured by the programs
+// unless a StageStats is given, which keeps the default runs unchanged.
+//
+// An optional progress thread prints the records done so far to stderr.
+class StageStats {
+public:
+    void add(const std::string &stage, const std::string &thread,
+            const std::string &chrom, const StageCounter &counter);
+    bool write_json(const std::string &fn, const std::string &program);
+    // progress of 'records' over 'items' (e.g. alignments and chromosomes)
+    bool start_progress(const double interval, const std::string &recordName,
+            const std::string &itemName, const long totalItems);
+    void add_progress(const long records, const long items) {
+        __sync_fetch_and_add(&progressRecords, records);
+        __sync_fetch_and_add(&progressItems, items);
+    }
+    void stop_progress(void);
+    StageStats();
+    ~StageStats();
+
+protected:
+    struct StageKey {
+        std::string stage, thread, chrom;
+        bool operator<(const StageKey &right) const;
+    };
+    static void *run_progress(void *arg);
+    void print_progress(void);
+
+    std::map<StageKey, StageCounter> counters;
+    pthread_mutex_t mutex;
+    double startWall;
+
+    // progress
+    long progressRecords, progressItems, totalItems;
+    double interval;
+    std::string recordName, itemName;
+    bool isProgressRunning;
+    pthread_t progressThread;
+    pthread_cond_t progressCond;
+};
+//------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,903 @@
+#include "histd.h"
+
+#include "alloc_counter.h"
+#include "count_matrix.h"
+#include "coverage_query.h"
+#include "gfflib.h"
+#include "hdf_base_depth_reader.h"
+
+#include <algorithm>
+#include <api/BamReader.h>
+#include <api/BamWriter.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define EX_BENCH_NUM_CHROMS 4
+#define EX_BENCH_MEAN_LENGTH 2000000
+#define EX_BENCH_LENGTH_CV 0.5
+#define EX_BENCH_DEPTH 30
+#define EX_BENCH_READ_LENGTH 100
+#define EX_BENCH_FRAGMENT_LENGTH 300
+#define EX_BENCH_GENES_PER_MB 20
+#define EX_BENCH_EXONS_PER_GENE 8
+#define EX_BENCH_SEED 1
+#define EX_BENCH_REPEATS 3
+// bases read per get_matrix() call in the read kernel
+#define EX_BENCH_WINDOW 65536
+// bases per call and threads of the read kernel inflating chunks in parallel
+#define EX_BENCH_INFLATE_WINDOW 1048576
+#define EX_BENCH_INFLATE_THREADS 4
+
+//------------------------------------------------------------------------------
+// shape of the synthetic data; the same values give the same references
+struct BenchParam {
+    int numChroms, meanLength, depth, readLength, fragmentLength;
+    double lengthCV;
+    int genesPerMb, exonsPerGene;
+    unsigned int seed;
+    bool isSparse;
+};
+//------------------------------------------------------------------------------
+// a mate of a synthetic pair, kept small until it is written
+struct SyntheticRead {
+    int position, matePosition, insertSize, pairId;
+    uint16_t flag;
+    uint8_t mapQuality, cigarType;
+    bool operator<(const SyntheticRead &right) const {
+        if (position != right.position)
+            return position < right.position;
+        return pairId < right.pairId;
+    }
+};
+enum SyntheticCigar {
+    BENCH_CIGAR_MATCH,
+    BENCH_CIGAR_LEFT_CLIP,
+    BENCH_CIGAR_RIGHT_CLIP,
+    BENCH_CIGAR_DELETION
+};
+//------------------------------------------------------------------------------
+struct BenchResult {
+    std::string name;
+    int repeats, exitStatus;
+    double seconds, userSeconds, systemSeconds;
+    long alignments, bases, features, peakRss;
+    long newCalls;  // operator new calls after the first repeat
+    BenchResult() {
+        repeats = 1;
+        exitStatus = 0;
+        seconds = userSeconds = systemSeconds = 0;
+        alignments = bases = features = peakRss = -1;
+        newCalls = -1;
+    }
+};
+//------------------------------------------------------------------------------
+double get_wall_time(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+//------------------------------------------------------------------------------
+long get_peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+//------------------------------------------------------------------------------
+void write_rate(const char *key, const long count, const double seconds,
+        std::ostream &ost) {
+    if (0 > count)
+        return;
+    ost << ",\"" << key << "\":" << count << ",\"" << key
+        << "_per_second\":" << ((0 < seconds) ? count / seconds : 0);
+}
+//------------------------------------------------------------------------------
+// one JSON object per line
+void write_result(const BenchResult &result, std::ostream &ost) {
+    ost << "{\"benchmark\":\"" << result.name << "\",\"repeats\":"
+        << result.repeats << ",\"seconds\":" << result.seconds;
+    if (0 < result.userSeconds + result.systemSeconds) {
+        ost << ",\"user_seconds\":" << result.userSeconds
+            << ",\"system_seconds\":" << result.systemSeconds
+            << ",\"exit_status\":" << result.exitStatus;
+    }
+    write_rate("alignments", result.alignments, result.seconds, ost);
+    write_rate("bases", result.bases, result.seconds, ost);
+    write_rate("features", result.features, result.seconds, ost);
+    if (0 <= result.newCalls)
+        ost << ",\"operator_new_calls\":" << result.newCalls;
+    ost << ",\"peak_rss_kb\":" << result.peakRss << "}" << ENDL;
+}
+//------------------------------------------------------------------------------
+// Reference lengths follow a log-normal distribution with the given mean and
+// coefficient of variation (0 for equal lengths).
+void make_references(const BenchParam &bp, BamTools::RefVector &refs) {
+    std::mt19937 rng(bp.seed);
+    const double sigma = std::sqrt(std::log(1 + bp.lengthCV * bp.lengthCV));
+    std::lognormal_distribution<double> lengthDist(
+            std::log((double)bp.meanLength) - sigma * sigma / 2, sigma);
+    const int minLength = 4 * bp.fragmentLength;
+    for (int c = 0; c < bp.numChroms; ++c) {
+        const double length
+                = (0 < bp.lengthCV) ? lengthDist(rng) : bp.meanLength;
+        std::stringstream name;
+        name << "chr" << c + 1;
+        refs.push_back(BamTools::RefData(name.str(),
+                (int)std::max((double)minLength, std::min(2e9, length))));
+    }
+}
+//------------------------------------------------------------------------------
+void set_cigar(const int cigarType, const int readLength,
+        std::vector<BamTools::CigarOp> &cigar) {
+    const int clip = std::max(1, readLength / 10);
+    cigar.clear();
+    switch (cigarType) {
+        case BENCH_CIGAR_LEFT_CLIP:
+            cigar.push_back(BamTools::CigarOp('S', clip));
+            cigar.push_back(BamTools::CigarOp('M', readLength - clip));
+            break;
+        case BENCH_CIGAR_RIGHT_CLIP:
+            cigar.push_back(BamTools::CigarOp('M', readLength - clip));
+            cigar.push_back(BamTools::CigarOp('S', clip));
+            break;
+        case BENCH_CIGAR_DELETION:
+            cigar.push_back(BamTools::CigarOp('M', readLength / 2));
+            cigar.push_back(BamTools::CigarOp('D', 5));
+            cigar.push_back(
+                    BamTools::CigarOp('M', readLength - readLength / 2));
+            break;
+        default:
+            cigar.push_back(BamTools::CigarOp('M', readLength));
+            break;
+    }
+}
+//------------------------------------------------------------------------------
+// Coordinate-sorted proper pairs at a uniform depth. Most reads are plain
+// matches; a few are clipped or have a deletion, some have a low mapping
+// quality or are marked as duplicates, so that filters and clip counting are
+// exercised.
+bool generate_bam(const std::string &bamFn, const BenchParam &bp) {
+    BamTools::RefVector refs;
+    make_references(bp, refs);
+    std::stringstream header;
+    header << "@HD\tVN:1.0\tSO:coordinate\n";
+    for (size_t r = 0; r < refs.size(); ++r) {
+        header << "@SQ\tSN:" << refs[r].RefName << "\tLN:"
+               << refs[r].RefLength << "\n";
+    }
+    BamTools::BamWriter writer;
+    if (!writer.Open(bamFn, header.str(), refs)) {
+        std::cerr << ERROR_STRING << "can't open " << bamFn
+                  << " for writing." << ENDL;
+        return false;
+    }
+
+    std::mt19937 rng(bp.seed + 1);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::normal_distribution<double> fragmentDist(
+            bp.fragmentLength, bp.fragmentLength / 10.0);
+    std::vector<SyntheticRead> reads;
+    BamTools::BamAlignment alignment;
+    alignment.Length = bp.readLength;
+    alignment.QueryBases.assign(bp.readLength, 'A');
+    alignment.Qualities.assign(bp.readLength, 'I');
+    long numAlignments = 0;
+    for (size_t r = 0; r < refs.size(); ++r) {
+        const int length = refs[r].RefLength;
+        const long numPairs
+                = (long)bp.depth * length / (2 * bp.readLength);
+        reads.clear();
+        reads.reserve(2 * numPairs);
+        for (long k = 0; k < numPairs; ++k) {
+            const int fragment = std::max(bp.readLength,
+                    std::min(length - 1, (int)fragmentDist(rng)));
+            const int position
+                    = (int)(unit(rng) * (length - fragment + 1));
+            const double u = unit(rng);
+            const uint8_t mapq = (0.1 > unit(rng)) ? 0 : 60;
+            const uint16_t dup = (0.03 > unit(rng)) ? 1024 : 0;
+            SyntheticRead first, second;
+            first.pairId = second.pairId = k;
+            first.position = second.matePosition = position;
+            second.position = first.matePosition
+                    = position + fragment - bp.readLength;
+            first.insertSize = fragment;
+            second.insertSize = -fragment;
+            first.mapQuality = second.mapQuality = mapq;
+            first.flag = 1 | 2 | 32 | 64 | dup;
+            second.flag = 1 | 2 | 16 | 128 | dup;
+            first.cigarType = (0.85 > u) ? BENCH_CIGAR_MATCH
+                    : (0.90 > u)         ? BENCH_CIGAR_LEFT_CLIP
+                    : (0.95 > u)         ? BENCH_CIGAR_RIGHT_CLIP
+                                         : BENCH_CIGAR_DELETION;
+            second.cigarType = BENCH_CIGAR_MATCH;
+            reads.push_back(first);
+            reads.push_back(second);
+        }
+        std::sort(reads.begin(), reads.end());
+
+        for (std::vector<SyntheticRead>::const_iterator read = reads.begin();
+                read != reads.end(); ++read) {
+            std::stringstream name;
+            name << refs[r].RefName << "_" << read->pairId;
+            alignment.Name = name.str();
+            alignment.RefID = alignment.MateRefID = r;
+            alignment.Position = read->position;
+            alignment.MatePosition = read->matePosition;
+            alignment.InsertSize = read->insertSize;
+            alignment.AlignmentFlag = read->flag;
+            alignment.MapQuality = read->mapQuality;
+            set_cigar(read->cigarType, bp.readLength, alignment.CigarData);
+            if (!writer.SaveAlignment(alignment)) {
+                std::cerr << ERROR_STRING << "failed to write an alignment "
+                          << "to " << bamFn << "." << ENDL;
+                return false;
+            }
+        }
+        numAlignments += reads.size();
+    }
+    writer.Close();
+
+    BamTools::BamReader reader;
+    if (!reader.Open(bamFn)
+            || !reader.CreateIndex(BamTools::BamIndex::STANDARD)) {
+        std::cerr << ERROR_STRING << "failed to index " << bamFn << "."
+                  << ENDL;
+        return false;
+    }
+    reader.Close();
+    std::cerr << INFO_STRING << numAlignments << " alignments on "
+              << refs.size() << " reference(s) written to " << bamFn << "."
+              << ENDL;
+    return true;
+}
+//------------------------------------------------------------------------------
+// genes at random positions, each with evenly spaced exons (Parent=gene)
+bool generate_gff(const std::string &gffFn, const BenchParam &bp) {
+    BamTools::RefVector refs;
+    make_references(bp, refs);
+    std::ofstream ofs(gffFn.c_str());
+    if (ofs.fail()) {
+        std::cerr << ERROR_STRING << "can't open " << gffFn
+                  << " for writing." << ENDL;
+        return false;
+    }
+
+    std::mt19937 rng(bp.seed + 2);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::exponential_distribution<double> geneLengthDist(1 / 20000.0);
+    const int exonLength = 150;
+    long numGenes = 0;
+    for (size_t r = 0; r < refs.size(); ++r) {
+        const int length = refs[r].RefLength;
+        const int numRefGenes
+                = std::max(1L, (long)bp.genesPerMb * length / 1000000);
+        std::vector<std::pair<int, int> > genes;
+        for (int g = 0; g < numRefGenes; ++g) {
+            const int geneLength = std::min(length - 1,
+                    std::max(bp.exonsPerGene * exonLength,
+                            (int)geneLengthDist(rng)));
+            const int start = 1 + (int)(unit(rng) * (length - geneLength));
+            genes.push_back(std::make_pair(start, start + geneLength - 1));
+        }
+        std::sort(genes.begin(), genes.end());
+
+        for (size_t g = 0; g < genes.size(); ++g) {
+            const int start = genes[g].first, end = genes[g].second;
+            std::stringstream id;
+            id << refs[r].RefName << "_g" << g + 1;
+            ofs << refs[r].RefName << "\tbench\tgene\t" << start << '\t' << end
+                << "\t.\t+\t.\tID=" << id.str() << ENDL;
+            const double step = (double)(end - start + 1) / bp.exonsPerGene;
+            for (int e = 0; e < bp.exonsPerGene; ++e) {
+                const int exonStart = start + (int)(e * step);
+                const int exonEnd = std::min(end,
+                        exonStart + std::min(exonLength, (int)step) - 1);
+                ofs << refs[r].RefName << "\tbench\texon\t" << exonStart
+                    << '\t' << exonEnd << "\t.\t+\t.\tParent=" << id.str()
+                    << ENDL;
+            }
+        }
+        numGenes += genes.size();
+    }
+    ofs.close();
+    std::cerr << INFO_STRING << numGenes << " genes with " << bp.exonsPerGene
+              << " exons each written to " << gffFn << "." << ENDL;
+    return !ofs.fail();
+}
+//------------------------------------------------------------------------------
+// A matrix written by write_hdf() without a BAM: the depth is drawn per read
+// length window around the mean, with a few zero-depth gaps.
+bool generate_matrix(const std::string &matrixFn, const BenchParam &bp) {
+    BamTools::RefVector refs;
+    make_references(bp, refs);
+    H5::Exception::dontPrint();
+    bool isLegacy = false;
+    H5::H5File *file = open_output(matrixFn, OUTPUT_MODE_CREATE, &isLegacy);
+    if (NULL == file)
+        return false;
+
+    std::mt19937 rng(bp.seed + 3);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::poisson_distribution<int> depthDist(bp.depth);
+    const AlignmentFilterArray filters;
+    std::vector<IntMatrixType> matrix, clipendMatrix;
+    bool isSuccess = true;
+    for (size_t r = 0; r < refs.size() && isSuccess; ++r) {
+        const int length = refs[r].RefLength;
+        matrix.assign(length, 0);
+        clipendMatrix.assign(length, 0);
+        for (int pos = 0; pos < length; pos += bp.readLength) {
+            const int depth = (0.03 > unit(rng)) ? 0 : depthDist(rng);
+            std::fill(matrix.begin() + pos,
+                    matrix.begin() + std::min(length, pos + bp.readLength),
+                    depth);
+        }
+        DepthStat depthStat;
+        make_depth_stat(matrix.data(), length, &depthStat);
+        const int uniqueReadCount
+                = (long)bp.depth * length / bp.readLength;
+        isSuccess = write_hdf(file, refs[r].RefName.c_str(), matrix.data(),
+                clipendMatrix.data(), &length, &uniqueReadCount, filters,
+                NULL, NULL, bp.isSparse, NULL, &depthStat);
+    }
+    delete file;
+    if (isSuccess) {
+        std::cerr << INFO_STRING << refs.size() << " reference(s) written to "
+                  << matrixFn << "." << ENDL;
+    }
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+// mapped alignments and reference bases of a BAM
+bool count_bam(const std::string &bamFn, long *alignments, long *bases) {
+    BamTools::BamReader reader;
+    if (!reader.Open(bamFn)) {
+        std::cerr << ERROR_STRING << "can't open " << bamFn << "." << ENDL;
+        return false;
+    }
+    const BamTools::RefVector refs = reader.GetReferenceData();
+    *bases = 0;
+    for (size_t r = 0; r < refs.size(); ++r)
+        *bases += refs[r].RefLength;
+    *alignments = 0;
+    BamTools::BamAlignment alignment;
+    while (reader.GetNextAlignmentCore(alignment)) {
+        if (alignment.IsMapped())
+            ++(*alignments);
+    }
+    reader.Close();
+    return true;
+}
+//------------------------------------------------------------------------------
+// thread_make_matrix() on each reference in turn, then write_hdf() of all of
+// them into a scratch matrix
+bool bench_count_and_write(const std::string &bamFn,
+        const std::string &scratchFn, const int repeats, std::ostream &ost) {
+    BenchResult count, write;
+    count.name = "kernel.thread_make_matrix";
+    write.name = "kernel.write_hdf";
+    count.repeats = write.repeats = repeats;
+    if (!count_bam(bamFn, &count.alignments, &count.bases))
+        return false;
+    write.bases = count.bases;
+    const BamTools::RefVector refs = get_refvector(bamFn);
+
+    H5::Exception::dontPrint();
+    const AlignmentFilterArray filters;
+    CountBufferPool pool;
+    std::vector<ThreadCountParam> param(refs.size());
+    std::vector<IntMatrixType *> buffers;
+    for (int rep = 0; rep < repeats; ++rep) {
+        double start = get_wall_time();
+        for (size_t r = 0; r < refs.size(); ++r) {
+            ThreadCountParam &p = param[r];
+            p.input_fn = bamFn;
+            p.ref_name = refs[r].RefName;
+            p.ref_index = r;
+            p.ref_start = 0;
+            p.ref_end = p.ref_length = p.matrix_length = refs[r].RefLength;
+            p.unique_read_count = 0;
+            p.regions = NULL;
+            p.filters = &filters;
+            p.track_matrix = NULL;
+            p.is_fragment_depth = false;
+            p.is_sparse = false;
+            p.pool = &pool;
+            p.stats = NULL;
+            thread_make_matrix(&p);
+            if (!p.is_allocated) {
+                std::cerr << ERROR_STRING << "count buffers are not "
+                          << "available." << ENDL;
+                return false;
+            }
+            if (p.is_failed)
+                return false;
+        }
+        const double countSeconds = get_wall_time() - start;
+        if (0 == rep || countSeconds < count.seconds)
+            count.seconds = countSeconds;
+
+        bool isLegacy = false;
+        start = get_wall_time();
+        H5::H5File *file
+                = open_output(scratchFn, OUTPUT_MODE_CREATE, &isLegacy);
+        bool isSuccess = (NULL != file);
+        for (size_t r = 0; r < refs.size() && isSuccess; ++r) {
+            const ThreadCountParam &p = param[r];
+            isSuccess = write_hdf(file, p.ref_name.c_str(), p.matrix,
+                    p.clipend_matrix, &p.ref_length, &p.unique_read_count,
+                    filters, p.track_matrix, p.fragment_matrix, p.is_sparse,
+                    NULL, &p.depth_stat);
+        }
+        delete file;
+        const double writeSeconds = get_wall_time() - start;
+        if (0 == rep || writeSeconds < write.seconds)
+            write.seconds = writeSeconds;
+
+        for (size_t r = 0; r < refs.size(); ++r)
+            get_count_matrices(&param[r], buffers);
+        release_count_matrices(&pool, buffers);
+        if (!isSuccess)
+            return false;
+    }
+    std::remove(scratchFn.c_str());
+    count.peakRss = write.peakRss = get_peak_rss();
+    write_result(count, ost);
+    write_result(write, ost);
+    return true;
+}
+//------------------------------------------------------------------------------
+// whole chromosomes read in windows of 'window' bases, inflating the chunks
+// of a window by 'inflateThreads' threads (1 for the HDF5 read path)
+bool bench_get_matrix(const std::string &matrixFn, const std::string &name,
+        const int window, const int inflateThreads, const int repeats,
+        std::ostream &ost) {
+    BenchResult result;
+    result.name = name;
+    result.repeats = repeats;
+    std::vector<IntType> buffer(window);
+    for (int rep = 0; rep < repeats; ++rep) {
+        const double start = get_wall_time();
+        HdfBaseDepthReader hdf;
+        hi::StringArray chroms;
+        if (!hdf.open(matrixFn.c_str()) || !hdf.get_group_names(chroms))
+            return false;
+        hdf.set_inflate_threads(inflateThreads);
+        long bases = 0;
+        for (hi::StringArray::const_iterator chrom = chroms.begin();
+                chrom != chroms.end(); ++chrom) {
+            if (!hdf.set_target_chromosome(chrom->c_str())
+                    || !hdf.set_target_dataset(
+                            EX_COVQ_DATASET, H5::PredType::STD_I32LE))
+                return false;
+            const int length = hdf.get_num_elements();
+            for (int pos = 0; pos < length; pos += window) {
+                const int count = std::min(window, length - pos);
+                if (!hdf.get_matrix(&pos, &count, buffer.data()))
+                    return false;
+            }
+            bases += length;
+        }
+        hdf.close();
+        const double seconds = get_wall_time() - start;
+        if (0 == rep || seconds < result.seconds)
+            result.seconds = seconds;
+        result.bases = bases;
+    }
+    result.peakRss = get_peak_rss();
+    write_result(result, ost);
+    return true;
+}
+//------------------------------------------------------------------------------
+// get_cover_stat() of every GFF record in the file order
+bool bench_get_cover_stat(const std::string &matrixFn,
+        const std::string &gffFn, const int repeats, std::ostream &ost) {
+    BenchResult result;
+    result.name = "kernel.get_cover_stat";
+    result.repeats = repeats;
+    GffRecordArray records;
+    if (!read_gff_from_file(gffFn.c_str(), records))
+        return false;
+    for (int rep = 0; rep < repeats; ++rep) {
+        const double start = get_wall_time();
+        HdfBaseDepthReader hdf;
+        if (!hdf.open(matrixFn.c_str()))
+            return false;
+        std::string currentChrom = "";
+        bool isChromFound = false;
+        long bases = 0;
+        for (GffRecordArray::const_iterator record = records.begin();
+                record != records.end(); ++record) {
+            if (record->seqid != currentChrom) {
+                currentChrom = record->seqid;
+                isChromFound = hdf.set_target_chromosome(currentChrom.c_str())
+                        && hdf.set_target_dataset(
+                                EX_COVQ_DATASET, H5::PredType::STD_I32LE);
+            }
+            if (!isChromFound)
+                continue;
+            const int szRegion = record->end - record->start + 1;
+            int coveredBases = 0;
+            float avgDepth = 0;
+            get_cover_stat(hdf, &record->start, &szRegion, &coveredBases,
+                    EX_COVQ_MIN_DEPTH, &avgDepth);
+            bases += szRegion;
+        }
+        hdf.close();
+        const double seconds = get_wall_time() - start;
+        if (0 == rep || seconds < result.seconds)
+            result.seconds = seconds;
+        result.bases = bases;
+    }
+    result.features = records.size();
+    result.peakRss = get_peak_rss();
+    write_result(result, ost);
+    return true;
+}
+//------------------------------------------------------------------------------
+// CoverageQuery of all GFF records at once. The first query opens the
+// datasets and grows the buffers, and the repeats that follow must not call
+// operator new; the kernel fails otherwise. HDF5 still calls malloc() in its
+// reads, which is not counted. The query inflates chunks on one thread, as
+// more threads start and are given their parameters on every read. Records on
+// chromosomes missing from the matrix call operator new for the HDF5
+// exception each time.
+bool bench_cover_query(const std::string &matrixFn, const std::string &gffFn,
+        const int repeats, std::ostream &ost) {
+    BenchResult result;
+    result.name = "kernel.cover_query";
+    result.repeats = repeats;
+    GffRecordArray records;
+    if (!read_gff_from_file(gffFn.c_str(), records))
+        return false;
+    CoverageRegionArray regions(records.size());
+    long bases = 0;
+    for (size_t r = 0; r < records.size(); ++r) {
+        regions[r].seqid = records[r].seqid;
+        regions[r].start = records[r].start;
+        regions[r].end = records[r].end;
+        bases += records[r].end - records[r].start + 1;
+    }
+
+    CoverageQuery query;
+    hi::StringArray matrixFiles(1, matrixFn);
+    CoverageStatArray stats;
+    if (!query.open(matrixFiles) || !query.query(regions, stats))
+        return false;
+    result.newCalls = 0;
+    for (int rep = 0; rep < repeats; ++rep) {
+        const double start = get_wall_time();
+        const long newCallsBefore = get_num_new_calls();
+        query.query(regions, stats);
+        result.newCalls += get_num_new_calls() - newCallsBefore;
+        const double seconds = get_wall_time() - start;
+        if (0 == rep || seconds < result.seconds)
+            result.seconds = seconds;
+    }
+    query.close();
+    result.bases = bases;
+    result.features = records.size();
+    result.peakRss = get_peak_rss();
+    write_result(result, ost);
+
+    if (0 < result.newCalls) {
+        std::cerr << ERROR_STRING << result.newCalls
+                  << " operator new calls in repeated queries (malloc() "
+                     "is not counted)."
+                  << ENDL;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// get_cover_stat() of every GFF record, once to grow the read buffer and then
+// 'repeats' times counting the operator new calls made by the calls alone;
+// switching the chromosome of the reader is not counted, nor is malloc() in
+// HDF5. Fails if any call reaches operator new.
+bool check_get_cover_stat(const std::string &matrixFn,
+        const std::string &gffFn, const int repeats, std::ostream &ost) {
+    BenchResult result;
+    result.name = "check.get_cover_stat";
+    result.repeats = repeats;
+    GffRecordArray records;
+    HdfBaseDepthReader hdf;
+    if (!read_gff_from_file(gffFn.c_str(), records)
+            || !hdf.open(matrixFn.c_str()))
+        return false;
+    result.newCalls = 0;
+    long bases = 0;
+    for (int rep = 0; rep <= repeats; ++rep) {
+        const double start = get_wall_time();
+        std::string currentChrom = "";
+        bool isChromFound = false;
+        bases = 0;
+        for (GffRecordArray::const_iterator record = records.begin();
+                record != records.end(); ++record) {
+            if (record->seqid != currentChrom) {
+                currentChrom = record->seqid;
+                isChromFound = hdf.set_target_chromosome(currentChrom.c_str())
+                        && hdf.set_target_dataset(
+                                EX_COVQ_DATASET, H5::PredType::STD_I32LE);
+            }
+            if (!isChromFound)
+                continue;
+            const int szRegion = record->end - record->start + 1;
+            int coveredBases = 0;
+            float avgDepth = 0;
+            const long newCallsBefore = get_num_new_calls();
+            get_cover_stat(hdf, &record->start, &szRegion, &coveredBases,
+                    EX_COVQ_MIN_DEPTH, &avgDepth);
+            if (0 < rep)
+                result.newCalls += get_num_new_calls() - newCallsBefore;
+            bases += szRegion;
+        }
+        const double seconds = get_wall_time() - start;
+        if (1 == rep || (0 < rep && seconds < result.seconds))
+            result.seconds = seconds;
+    }
+    hdf.close();
+    result.bases = bases;
+    result.features = records.size();
+    result.peakRss = get_peak_rss();
+    write_result(result, ost);
+
+    if (0 == bases) {
+        std::cerr << ERROR_STRING << "no GFF record is on the references of "
+                  << matrixFn << "." << ENDL;
+        return false;
+    }
+    if (0 < result.newCalls) {
+        std::cerr << ERROR_STRING << result.newCalls
+                  << " operator new calls in repeated get_cover_stat() calls "
+                     "(malloc() is not counted)."
+                  << ENDL;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// Run a command 'repeats' times with its stdout discarded and report the best
+// wall time and the largest peak RSS of the child. Counts for the rates are
+// taken from the BAM and GFF given.
+bool bench_command(const std::string &name, char *const *command,
+        const std::string &bamFn, const std::string &gffFn, const int repeats,
+        std::ostream &ost) {
+    BenchResult result;
+    result.name = name;
+    result.repeats = repeats;
+    if (!bamFn.empty() && !count_bam(bamFn, &result.alignments, &result.bases))
+        return false;
+    if (!gffFn.empty()) {
+        GffRecordArray records;
+        if (!read_gff_from_file(gffFn.c_str(), records))
+            return false;
+        result.features = records.size();
+    }
+
+    for (int rep = 0; rep < repeats; ++rep) {
+        const double start = get_wall_time();
+        const pid_t pid = fork();
+        if (0 > pid) {
+            std::cerr << ERROR_STRING << "fork() failed." << ENDL;
+            return false;
+        }
+        if (0 == pid) {
+            const int devnull = open("/dev/null", O_WRONLY);
+            if (0 <= devnull)
+                dup2(devnull, STDOUT_FILENO);
+            execvp(command[0], command);
+            std::cerr << ERROR_STRING << "can't run " << command[0] << "."
+                      << ENDL;
+            _exit(127);
+        }
+        int status = 0;
+        struct rusage usage;
+        if (0 > wait4(pid, &status, 0, &usage))
+            return false;
+        const double seconds = get_wall_time() - start;
+        if (0 == rep || seconds < result.seconds) {
+            result.seconds = seconds;
+            result.userSeconds
+                    = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+            result.systemSeconds
+                    = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+        }
+        result.peakRss = std::max(result.peakRss, (long)usage.ru_maxrss);
+        result.exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (0 != result.exitStatus)
+            break;
+    }
+    write_result(result, ost);
+    return 0 == result.exitStatus;
+}
+//------------------------------------------------------------------------------
+void print_bench_usage(const char *cmd) {
+    std::cerr << USAGE_STRING << cmd << " command (options)" << ENDL;
+    std::cerr << "Commands:" << ENDL;
+    std::cerr << " gen-bam -o bam      synthetic coordinate-sorted, indexed "
+                 "BAM of proper pairs"
+              << ENDL;
+    std::cerr << " gen-gff -o gff      genes and exons on the same references"
+              << ENDL;
+    std::cerr << " gen-matrix -o h5    depth matrix written without a BAM (-S "
+                 "for sparse tracks)"
+              << ENDL;
+    std::cerr << " kernels -b bam -m h5 -g gff -w scratch.h5" << ENDL
+              << "                     thread_make_matrix, write_hdf, "
+                 "get_matrix, get_matrix_inflate (-t threads),"
+              << ENDL << "                     get_cover_stat and cover_query "
+                         "(fails if repeated queries call operator new)"
+              << ENDL;
+    std::cerr << " check-alloc -m h5 -g gff" << ENDL
+              << "                     fails if warm get_cover_stat or "
+                 "cover_query calls reach operator new (not malloc)"
+              << ENDL;
+    std::cerr << " run -n name (-b bam) (-g gff) -- command args..." << ENDL
+              << "                     end-to-end run of a command" << ENDL;
+    std::cerr << "Options of the generators (the same values give the same "
+                 "references):"
+              << ENDL;
+    std::cerr << " -c  number of references [" << EX_BENCH_NUM_CHROMS << "]"
+              << ENDL;
+    std::cerr << " -L  mean reference length [" << EX_BENCH_MEAN_LENGTH << "]"
+              << ENDL;
+    std::cerr << " -V  coefficient of variation of the lengths, 0 for equal ["
+              << EX_BENCH_LENGTH_CV << "]" << ENDL;
+    std::cerr << " -d  depth [" << EX_BENCH_DEPTH << "]" << ENDL;
+    std::cerr << " -l  read length [" << EX_BENCH_READ_LENGTH << "]" << ENDL;
+    std::cerr << " -f  mean fragment length [" << EX_BENCH_FRAGMENT_LENGTH
+              << "]" << ENDL;
+    std::cerr << " -G  genes per Mb [" << EX_BENCH_GENES_PER_MB << "]" << ENDL;
+    std::cerr << " -e  exons per gene [" << EX_BENCH_EXONS_PER_GENE << "]"
+              << ENDL;
+    std::cerr << " -s  random seed [" << EX_BENCH_SEED << "]" << ENDL;
+    std::cerr << " -t  threads inflating chunks in get_matrix_inflate ["
+              << EX_BENCH_INFLATE_THREADS << "]" << ENDL;
+    std::cerr << " -r  repeats of kernels and runs; the best time is reported ["
+              << EX_BENCH_REPEATS << "]" << ENDL
+              << ENDL;
+    std::cerr << "Results are written to stdout as one JSON object per line."
+              << ENDL << ENDL;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    if (2 > argc) {
+        print_bench_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const std::string command = argv[1];
+    if ("-h" == command) {
+        print_bench_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+    }
+
+    BenchParam bp;
+    bp.numChroms = EX_BENCH_NUM_CHROMS;
+    bp.meanLength = EX_BENCH_MEAN_LENGTH;
+    bp.lengthCV = EX_BENCH_LENGTH_CV;
+    bp.depth = EX_BENCH_DEPTH;
+    bp.readLength = EX_BENCH_READ_LENGTH;
+    bp.fragmentLength = EX_BENCH_FRAGMENT_LENGTH;
+    bp.genesPerMb = EX_BENCH_GENES_PER_MB;
+    bp.exonsPerGene = EX_BENCH_EXONS_PER_GENE;
+    bp.seed = EX_BENCH_SEED;
+    bp.isSparse = false;
+    std::string outputFn = "", bamFn = "", matrixFn = "", gffFn = "",
+                scratchFn = "", name = "";
+    int repeats = EX_BENCH_REPEATS;
+    int inflateThreads = EX_BENCH_INFLATE_THREADS;
+
+    // parse arguments; 'run' takes the command after '--'
+    optind = 2;
+    char option;
+    while ((option = getopt(argc, argv, "o:b:m:g:w:n:c:L:V:d:l:f:G:e:s:r:t:Sh"))
+            != -1) {
+        switch (option) {
+            case 'o':
+                outputFn = optarg;
+                break;
+            case 'b':
+                bamFn = optarg;
+                break;
+            case 'm':
+                matrixFn = optarg;
+                break;
+            case 'g':
+                gffFn = optarg;
+                break;
+            case 'w':
+                scratchFn = optarg;
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'c':
+                bp.numChroms = std::atoi(optarg);
+                break;
+            case 'L':
+                bp.meanLength = std::atoi(optarg);
+                break;
+            case 'V':
+                bp.lengthCV = std::atof(optarg);
+                break;
+            case 'd':
+                bp.depth = std::atoi(optarg);
+                break;
+            case 'l':
+                bp.readLength = std::atoi(optarg);
+                break;
+            case 'f':
+                bp.fragmentLength = std::atoi(optarg);
+                break;
+            case 'G':
+                bp.genesPerMb = std::atoi(optarg);
+                break;
+            case 'e':
+                bp.exonsPerGene = std::atoi(optarg);
+                break;
+            case 's':
+                bp.seed = std::atoi(optarg);
+                break;
+            case 'r':
+                repeats = std::max(1, std::atoi(optarg));
+                break;
+            case 't':
+                inflateThreads = std::max(1, std::atoi(optarg));
+                break;
+            case 'S':
+                bp.isSparse = true;
+                break;
+            case 'h':
+                print_bench_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                print_bench_usage(argv[0]);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+    if (0 >= bp.numChroms || 0 >= bp.meanLength || 0 > bp.lengthCV
+            || 0 > bp.depth || 10 > bp.readLength
+            || bp.readLength > bp.fragmentLength || 0 >= bp.exonsPerGene) {
+        std::cerr << ERROR_STRING << "invalid generator options." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+
+    bool isSuccess = false;
+    if ("gen-bam" == command && !outputFn.empty()) {
+        isSuccess = generate_bam(outputFn, bp);
+    } else if ("gen-gff" == command && !outputFn.empty()) {
+        isSuccess = generate_gff(outputFn, bp);
+    } else if ("gen-matrix" == command && !outputFn.empty()) {
+        isSuccess = generate_matrix(outputFn, bp);
+    } else if ("kernels" == command && !bamFn.empty() && !matrixFn.empty()
+               && !gffFn.empty() && !scratchFn.empty()) {
+        isSuccess = bench_count_and_write(bamFn, scratchFn, repeats, std::cout)
+                && bench_get_matrix(matrixFn, "kernel.get_matrix",
+                        EX_BENCH_WINDOW, 1, repeats, std::cout)
+                && bench_get_matrix(matrixFn, "kernel.get_matrix_inflate",
+                        EX_BENCH_INFLATE_WINDOW, inflateThreads, repeats,
+                        std::cout)
+                && bench_get_cover_stat(matrixFn, gffFn, repeats, std::cout)
+                && bench_cover_query(matrixFn, gffFn, repeats, std::cout);
+    } else if ("check-alloc" == command && !matrixFn.empty()
+               && !gffFn.empty()) {
+        isSuccess = check_get_cover_stat(matrixFn, gffFn, repeats, std::cout)
+                && bench_cover_query(matrixFn, gffFn, repeats, std::cout);
+    } else if ("run" == command && !name.empty() && optind < argc) {
+        isSuccess = bench_command(
+                name, &argv[optind], bamFn, gffFn, repeats, std::cout);
+    } else {
+        print_bench_usage(argv[0]);
+    }
+    exit(isSuccess ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+//------------------------------------------------------------------------------